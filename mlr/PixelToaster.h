@@ -983,7 +983,7 @@ while ( display.open() )
 			if (internal)
 				return internal->update_begin();
 			else
-				return false;
+				return nullptr;
 		}
 
 		/// XXX Experimental -- End a display update.
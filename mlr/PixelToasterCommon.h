@@ -3,6 +3,7 @@
 // Part of the PixelToaster Framebuffer Library - http://www.pixeltoaster.com
 
 #ifndef PIXELTOASTER_NO_CRT
+#include <chrono>
 #include <ctime>
 #endif
 
@@ -132,6 +133,18 @@ namespace PixelToaster
 			return _wrapper;
 		}
 
+		// no framebuffer to lock unless a platform display provides one
+
+		Framebuffer * update_begin()
+		{
+			return nullptr;
+		}
+
+		bool update_end()
+		{
+			return true;
+		}
+
 	protected:
 
 		// note: override this "unified" update to implement your display update.
@@ -188,7 +201,9 @@ namespace PixelToaster
 
 #ifndef PIXELTOASTER_NO_CRT
 
-	// portable timer implementation for platforms without a specific high res timer
+	// portable timer implementation for platforms without a specific high res timer.
+	// std::clock() counts cpu time of the whole process on posix, so use the
+	// monotonic wall clock instead.
 
 	class PortableTimer : public PixelToaster::TimerInterface
 	{
@@ -196,21 +211,21 @@ namespace PixelToaster
 		
 		PortableTimer()
 		{
-			_resolution = 1.0 / CLOCKS_PER_SEC;
+			_resolution = double( std::chrono::steady_clock::period::num ) / std::chrono::steady_clock::period::den;
 			reset();
 		}
 		
 		void reset()
 		{
 			_time = 0;
-			_timeCounter = clock();
+			_timeCounter = std::chrono::steady_clock::now();
 			_deltaCounter = _timeCounter;
 		}
 		
 		double time()
 		{
-			clock_t counter = std::clock();
-			double delta = ( counter - _timeCounter ) * _resolution;
+			const auto counter = std::chrono::steady_clock::now();
+			double delta = std::chrono::duration<double>( counter - _timeCounter ).count();
 			_timeCounter = counter;
 			_time += delta;
 			return _time;
@@ -218,8 +233,8 @@ namespace PixelToaster
 		
 		double delta()
 		{
-			clock_t counter = std::clock();
-			double delta = ( counter - _deltaCounter ) * _resolution;
+			const auto counter = std::chrono::steady_clock::now();
+			double delta = std::chrono::duration<double>( counter - _deltaCounter ).count();
 			_deltaCounter = counter;
 			return delta;
 		}
@@ -231,17 +246,16 @@ namespace PixelToaster
 		
 		void wait(double seconds)
 		{
-			clock_t start = std::clock();
-			clock_t finish = start + clock_t( seconds / _resolution );
-			while ( std::clock() < finish );
+			const auto finish = std::chrono::steady_clock::now() + std::chrono::duration<double>( seconds );
+			while ( std::chrono::steady_clock::now() < finish );
 		}
 		
 	private:
 		
 		double _time;               ///< current time in seconds
 		double _resolution;			///< timer resolution in seconds
-		clock_t _timeCounter;		///< time counter in clocks
-		clock_t _deltaCounter;		///< delta counter in clocks
+		std::chrono::steady_clock::time_point _timeCounter;		///< time counter
+		std::chrono::steady_clock::time_point _deltaCounter;		///< delta counter
 	};
 	
 #else
@@ -0,0 +1,525 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "aligned_allocator.h"
+#include "PixelToaster.h"
+
+#include "bench.h"
+#include "canvas.h"
+#include "framestack.h"
+#include "mesh.h"
+#include "meshops.h"
+#include "perfcount.h"
+#include "render.h"
+#include "mcube.h"
+#include "stats.h"
+#include "texture.h"
+#include "utils.h"
+#include "viewport.h"
+
+using namespace std;
+using boost::format;
+
+
+bool parse_bench_args(const vector<string>& args, BenchConfig& config)
+{
+	for (size_t i = 0; i < args.size(); i++) {
+		const auto& arg = args[i];
+		if (arg == "--bench") continue;
+		if (arg == "--help" || arg == "-h") {
+			config.help = true;
+			return true;
+		}
+		if (arg == "--perf") {
+			config.perf = true;
+			continue;
+		}
+		if (arg == "--occlusion") {
+			config.occlusion = true;
+			continue;
+		}
+		if (arg == "--prepass") {
+			config.prepass = true;
+			continue;
+		}
+
+		if (i + 1 == args.size()) {
+			cout << "bench: missing value for " << arg << endl;
+			return false;
+		}
+		const auto& value = args[++i];
+
+		if (arg == "--data") {
+			config.data = value;
+			if (config.data.back() != '/' && config.data.back() != '\\') config.data += '/';
+		} else if (arg == "--out") {
+			config.output = value;
+		} else if (arg == "--trace") {
+			config.trace = value;
+		} else if (arg == "--scene") {
+			config.scene = value;
+		} else if (arg == "--kernels") {
+			config.kernels = value;
+		} else if (arg == "--bind") {
+			if (!cpu_bind_policy_from_name(value, config.bind)) {
+				cout << "bench: bind must be cores, threads or none" << endl;
+				return false;
+			}
+		} else if (arg == "--frames") {
+			config.frames = atoi(value.c_str());
+		} else if (arg == "--warmup") {
+			config.warmup = atoi(value.c_str());
+		} else if (arg == "--threads") {
+			config.threads.clear();
+			for (auto& item : explode(value, ',')) {
+				const int threads = atoi(item.c_str());
+				if (threads < 1) {
+					cout << "bench: thread counts must be at least 1" << endl;
+					return false;
+				}
+				config.threads.push_back(threads);
+			}
+		} else if (arg == "--size") {
+			config.sizes.clear();
+			for (auto& item : explode(value, ',')) {
+				int width, height;
+				if (sscanf(item.c_str(), "%dx%d", &width, &height) != 2) {
+					cout << "bench: size must look like 1280x720" << endl;
+					return false;
+				}
+				if (!canvas_size_valid(width, height)) {
+					cout << "bench: width must be a positive multiple of 4, height of 2" << endl;
+					return false;
+				}
+				config.sizes.push_back({ width, height });
+			}
+		} else {
+			cout << "bench: unknown option " << arg << endl;
+			return false;
+		}
+	}
+	return config.frames > 0 && !config.sizes.empty();
+}
+
+
+void print_bench_usage()
+{
+	cout << "usage: mlr --bench [options]" << endl;
+	cout << "stage and frame times are elapsed ms; --out adds each stage's cpu ms" << endl;
+	cout << "  --data dir       demo data directory (data/)" << endl;
+	cout << "  --out file       write results as json" << endl;
+	cout << "  --trace prefix   write a chrome trace per run" << endl;
+	cout << "  --scene name     run one scene: cubegrid, scatter, isocubes, tiles, rects" << endl;
+	cout << "  --size WxH,..    resolutions (640x360,1280x720,1920x1080)" << endl;
+	cout << "  --threads n,..   thread counts (1,2,4 .. cores)" << endl;
+	cout << "  --frames n       measured frames per run (60)" << endl;
+	cout << "  --warmup n       frames before measuring (10)" << endl;
+	cout << "  --perf           hardware counters per phase (linux)" << endl;
+	cout << "  --occlusion      cull against the previous frame's depth" << endl;
+	cout << "  --prepass        lay down depth before shading" << endl;
+	cout << "  --kernels name   raster kernels: sse2, sse41, avx2 (best supported)" << endl;
+	cout << "  --bind policy    worker placement: cores, threads, none (cores)" << endl;
+	cout << "  --help           this text" << endl;
+}
+
+
+/*
+ * a few spheres orbiting the middle of the unit cube, as the signed
+ * distance field that IsoCubes walks
+ */
+struct BenchBlobs {
+	vec4 center[4];
+
+	void animate(const double t) {
+		for (int i = 0; i < 4; i++) {
+			const double a = t * (0.7 + i * 0.3) + i * 1.57;
+			center[i] = vec4(float(0.5 + 0.25 * cos(a)), float(0.5 + 0.25 * sin(a * 1.3)), float(0.5 + 0.2 * sin(a)), 1);
+		}
+	}
+
+	float sample(const vec4& p) const {
+		float nearest = 1.0f;
+		for (int i = 0; i < 4; i++) {
+			const auto d = p - center[i];
+			nearest = std::min(nearest, sqrtf(d._x()*d._x() + d._y()*d._y() + d._z()*d._z()) - 0.15f);
+		}
+		return nearest;
+	}
+};
+
+
+/*
+ * everything a scene needs to add one frame to the pipeline.  Meshy
+ * ops go on the stack, which lives until the frame has been rendered.
+ */
+struct BenchFrame {
+	Pipeline& pipeline;
+	const MeshStore& meshstore;
+	const Viewport& vp;
+	const Viewdevice& vpd;
+	vector<unique_ptr<Meshy>>& stack;
+	BenchBlobs& blobs;
+	int matlow, mathigh;
+	double t;
+};
+
+struct BenchScene {
+	const char * name;
+	vector<string> meshes;
+	vector<string> textures;
+	function<void(BenchFrame&)> build;
+};
+
+#define previous_op (*bf.stack[bf.stack.size()-1])
+
+/*
+ * 8000 small cubes in a rotating grid
+ */
+void scene_cubegrid(BenchFrame& bf)
+{
+	const auto& cube = bf.meshstore.find("cube1x1.obj");
+	bf.stack.push_back(make_unique<MeshySet>      (&cube,       mat4::scale(vec3(4, 4, 4))));
+	bf.stack.push_back(make_unique<MeshyMultiply> (previous_op, 20, vec3(16, 0, 0), vec3(0, 0, 0)));
+	bf.stack.push_back(make_unique<MeshyMultiply> (previous_op, 20, vec3(0, 16, 0), vec3(0, 0, 0)));
+	bf.stack.push_back(make_unique<MeshyMultiply> (previous_op, 20, vec3(0, 0, 16), vec3(0, 0, 0)));
+	bf.stack.push_back(make_unique<MeshyCenter>   (previous_op, true, true, true, false));
+	bf.stack.push_back(make_unique<MeshyTranslate>(previous_op, mat4::rotate_x(bf.t*0.2)));
+	bf.stack.push_back(make_unique<MeshyTranslate>(previous_op, mat4::rotate_y(bf.t*0.3)));
+	bf.stack.push_back(make_unique<MeshyTranslate>(previous_op, mat4::position(vec3(0, 0, -450))));
+	bf.pipeline.addMeshy(previous_op, &bf.vp);
+}
+
+/*
+ * 2000 scattered cubes with random materials, three layers deep
+ */
+void scene_scatter(BenchFrame& bf)
+{
+	const auto& cube = bf.meshstore.find("cube1x1.obj");
+	bf.stack.push_back(make_unique<MeshySet>      (&cube,       mat4::scale(vec3(4, 4, 4))));
+	bf.stack.push_back(make_unique<MeshyScatter>  (previous_op, 2000, vec3(400, 200, 400)));
+	bf.stack.push_back(make_unique<MeshyCenter>   (previous_op, true, true, true, false));
+	bf.stack.push_back(make_unique<MeshyTranslate>(previous_op, mat4::rotate_y(bf.t*0.1)));
+	bf.stack.push_back(make_unique<MeshyMultiply> (previous_op, 3, vec3(0, 0, -450), vec3(0, 0, 0)));
+	bf.stack.push_back(make_unique<MeshyTranslate>(previous_op, mat4::position(vec3(0, 0, -350))));
+	bf.stack.push_back(make_unique<MeshyMaterial> (previous_op, bf.matlow, bf.mathigh));
+	bf.pipeline.addMeshy(previous_op, &bf.vp);
+}
+
+/*
+ * marching cubes through the glVertex path, one slice per geometry job
+ */
+void scene_isocubes(BenchFrame& bf)
+{
+	bf.blobs.animate(bf.t);
+	const auto xform = mat4_mul(mat4::position(vec3(0, 0, -300)), mat4_mul(mat4::rotate_y(bf.t*0.3), mat4_mul(mat4::scale(vec3(200, 200, 200)), mat4::position(vec3(-0.5, -0.5, -0.5)))));
+	const Viewport * const vp = &bf.vp;
+	const Viewdevice * const vpd = &bf.vpd;
+	BenchBlobs * const blobs = &bf.blobs;
+	const int material = bf.matlow;
+
+	bf.pipeline.addProcedural([=](Pipedata& pipe, const int slice, const int slices) {
+		IsoCubes<BenchBlobs> cubes(*blobs);
+		cubes.set_grid(48);
+		cubes.set_target(0.0f);
+		pipe.glBegin(*vp, *vpd);
+		pipe.glLoadMatrix(xform);
+		pipe.glMaterial(material);
+		cubes.run(pipe, slice, slices);
+		pipe.glEnd();
+	});
+}
+
+/*
+ * the textured floor
+ */
+void scene_tiles(BenchFrame& bf)
+{
+	const auto& tiles = bf.meshstore.find("tiles1.obj");
+	bf.stack.push_back(make_unique<MeshySet>      (&tiles,      mat4::rotate_x(3.14 / 2.0f)));
+	bf.stack.push_back(make_unique<MeshyCenter>   (previous_op, true, true, true, false));
+	bf.stack.push_back(make_unique<MeshyTranslate>(previous_op, mat4::rotate_y(bf.t*0.1)));
+	bf.stack.push_back(make_unique<MeshyTranslate>(previous_op, mat4::position(vec3(0, -20, -200))));
+	bf.pipeline.addMeshy(previous_op, &bf.vp);
+}
+
+/*
+ * full screen distort and overlay passes, no geometry
+ */
+void scene_rects(BenchFrame& bf)
+{
+	auto& pipe = *bf.pipeline.getPipe();
+	pipe.rect_begin(1);
+	pipe.rect_data(float(bf.t));
+	pipe.rect_data(0.5f);
+	pipe.rect_data(0.5f);
+	pipe.rect_data(64.0f);
+	pipe.rect_data(0.5f);
+	pipe.rect_data(1.0f);
+	pipe.rect_data(0.0f);
+	pipe.rect_data(0.0f);
+	pipe.rect_end();
+	pipe.rect_begin(2);
+	pipe.rect_end();
+}
+
+#undef previous_op
+
+
+/*
+ * nearest-rank percentile of an unsorted sample
+ */
+double percentile(vector<double> samples, const double p)
+{
+	sort(samples.begin(), samples.end());
+	const int rank = int(ceil(p / 100.0 * samples.size())) - 1;
+	return samples[max(0, min(rank, int(samples.size()) - 1))];
+}
+
+
+struct BenchResult {
+	string scene;
+	int width, height, threads;
+	vector<double> samples[TELESTAGE_COUNT + 1];   // elapsed per stage, then whole frame
+	vector<double> cpu[TELESTAGE_COUNT];           // per stage, summed over the workers
+	double bin_peak_kb;   // bin arena high-water mark, all workers
+	bool has_perf;
+	Perftotals perf;   // summed over the measured frames and all workers
+};
+
+const char * const bench_stage_names[TELESTAGE_COUNT + 1] = {
+	"geometry", "index_bins", "raster", "convert", "frame"
+};
+
+
+/*
+ * ipc and misses per thousand instructions for every phase
+ */
+void print_perf(const Perftotals& perf)
+{
+	cout << format("  %-8s %14s %6s %9s %9s %9s") % "phase" % "cycles" % "ipc" % "l1d/ki" % "llc/ki" % "brmiss/ki" << endl;
+	for (int pi = 0; pi < PERFPHASE_COUNT; pi++) {
+		const auto& c = perf.count[pi];
+		const double ki = c[PERF_INSTRUCTIONS] / 1000.0;
+		cout << format("  %-8s %14d %6.2f %9.3f %9.3f %9.3f")
+			% perfphase_names[pi] % c[PERF_CYCLES]
+			% (c[PERF_CYCLES] ? double(c[PERF_INSTRUCTIONS]) / c[PERF_CYCLES] : 0.0)
+			% (ki > 0 ? c[PERF_L1D_MISSES] / ki : 0.0)
+			% (ki > 0 ? c[PERF_LLC_MISSES] / ki : 0.0)
+			% (ki > 0 ? c[PERF_BRANCH_MISSES] / ki : 0.0) << endl;
+	}
+}
+
+
+string results_to_json(const vector<BenchResult>& results, const string& kernels)
+{
+	stringstream ss;
+	ss << format("{\n\t\"units\": \"ms\",\n\t\"stage_time\": \"elapsed\",\n\t\"cpu_time\": \"summed over workers\",\n\t\"kernels\": \"%s\",\n\t\"results\": [\n") % kernels;
+	for (size_t ri = 0; ri < results.size(); ri++) {
+		const auto& result = results[ri];
+		ss << format("\t\t{\"scene\": \"%s\", \"width\": %d, \"height\": %d, \"threads\": %d, \"frames\": %d, \"bin_peak_kb\": %.1f,\n")
+			% result.scene % result.width % result.height % result.threads % result.samples[0].size() % result.bin_peak_kb;
+		for (int si = 0; si <= TELESTAGE_COUNT; si++) {
+			const auto& samples = result.samples[si];
+			ss << format("\t\t\t\"%s\": {\"min\": %.4f, \"median\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f")
+				% bench_stage_names[si]
+				% percentile(samples, 0) % percentile(samples, 50) % percentile(samples, 90)
+				% percentile(samples, 99) % percentile(samples, 100);
+			if (si < TELESTAGE_COUNT) {
+				ss << format(", \"cpu_median\": %.4f") % percentile(result.cpu[si], 50);
+			}
+			ss << "}";
+			ss << (si < TELESTAGE_COUNT || result.has_perf ? ",\n" : "\n");
+		}
+		if (result.has_perf) {
+			ss << "\t\t\t\"perf\": {\n";
+			for (int pi = 0; pi < PERFPHASE_COUNT; pi++) {
+				ss << format("\t\t\t\t\"%s\": {") % perfphase_names[pi];
+				for (int ci = 0; ci < PERF_COUNTER_COUNT; ci++) {
+					ss << format("\"%s\": %d%s") % perfcounter_names[ci] % result.perf.count[pi][ci] % (ci + 1 < PERF_COUNTER_COUNT ? ", " : "");
+				}
+				ss << (pi + 1 < PERFPHASE_COUNT ? "},\n" : "}\n");
+			}
+			ss << "\t\t\t}\n";
+		}
+		ss << (ri + 1 < results.size() ? "\t\t},\n" : "\t\t}\n");
+	}
+	ss << "\t]\n}\n";
+	return ss.str();
+}
+
+
+int BenchApplication::run()
+{
+	MeshStore meshstore;
+	MaterialStore materialstore;
+	TextureStore texturestore;
+
+	texturestore.loadDirectory(config.data + "textures/");
+	meshstore.loadDirectory(config.data + "meshes/", materialstore, texturestore);
+
+	// fixed colors, so that every run shades the same.  kd is scaled like
+	// the demo's random materials
+	const int matlow = materialstore.store.size();
+	const vec3 colors[3] = { vec3(1, 0.5, 0.25), vec3(0.25, 1, 0.5), vec3(0.5, 0.25, 1) };
+	for (int i = 0; i < 3; i++) {
+		Material m;
+		m.name = (format("bench_%d") % i).str();
+		m.imagename = "";
+		m.kd = colors[i] * vec3(64);
+		m.pass = 0;
+		materialstore.store.push_back(m);
+	}
+	const int mathigh = matlow + 2;
+
+	const vector<BenchScene> scenes = {
+		{ "cubegrid", { "cube1x1.obj" }, {}, scene_cubegrid },
+		{ "scatter",  { "cube1x1.obj" }, {}, scene_scatter },
+		{ "isocubes", {}, {}, scene_isocubes },
+		{ "tiles",    { "tiles1.obj" }, {}, scene_tiles },
+		{ "rects",    {}, { "girl256.png", "water-girl.png" }, scene_rects },
+	};
+
+	set_cpu_bind_policy(config.bind);
+	vector<int> thread_counts = config.threads;
+	if (thread_counts.empty()) {
+		const int cores = get_cpu_count();
+		for (int n = 1; n < cores; n *= 2) {
+			thread_counts.push_back(n);
+		}
+		thread_counts.push_back(cores);
+	}
+
+	const RasterKernels * kernels = &raster_kernels();
+	if (!config.kernels.empty()) {
+		kernels = find_kernels(config.kernels);
+		if (kernels == nullptr) {
+			cout << "bench: no " << config.kernels << " kernels in this build or on this cpu" << endl;
+			return 1;
+		}
+	}
+	cout << "bench: " << kernels->name << " kernels" << endl;
+
+	fs_init();
+	perf_enable(config.perf);
+
+	vector<BenchResult> results;
+	for (const auto& scene : scenes) {
+		if (!config.scene.empty() && config.scene != scene.name) continue;
+
+		bool ready = true;
+		for (auto& name : scene.meshes) {
+			if (meshstore.store.empty() || meshstore.store[meshstore.index_of(name)].name != name) ready = false;
+		}
+		for (auto& name : scene.textures) {
+			if (texturestore.find(name) == nullptr) ready = false;
+		}
+		if (!ready) {
+			cout << "bench: skipping " << scene.name << ", assets missing" << endl;
+			continue;
+		}
+
+		for (const int threads : thread_counts) {
+			for (const auto& size : config.sizes) {
+				const int width = size.first, height = size.second;
+				Telemetry telemetry(threads);
+				Pipeline pipeline(threads, 0, telemetry);
+				pipeline.setOcclusion(config.occlusion);
+				pipeline.setDepthPrepass(config.prepass);
+				pipeline.setKernels(*kernels);
+				SOACanvas colorbuffer;
+				SOADepth depthbuffer;
+				colorbuffer.setup(width, height);
+				depthbuffer.setup(width, height);
+				Viewdevice vpd(width, height);
+				Viewport vp(float(width) / float(height), 60.0f);
+				vectorsse<TrueColorPixel> target(width * height);
+				BenchBlobs blobs;
+
+				BenchResult result;
+				result.scene = scene.name;
+				result.width = width;
+				result.height = height;
+				result.threads = threads;
+
+				Timer timer;
+				for (int frame = 0; frame < config.warmup + config.frames; frame++) {
+					if (frame == config.warmup) perf_reset();
+					fs_reset();
+					telemetry.start();
+					const double t0 = timer.time();
+
+					vector<unique_ptr<Meshy>> stack;
+					pipeline.reset(width, height);
+					pipeline.setViewdevice(&vpd);
+					pipeline.addCamera(mat4::ident());
+					pipeline.addLight({ vec4(50, 50, 10, 1), vec4(1, 1, 1, 0), 100.0f, vec4(1, 1, 1, 0), 0, true });
+					pipeline.clear(true, vec4(0, 0, 0, 0));
+
+					BenchFrame bf = { pipeline, meshstore, vp, vpd, stack, blobs, matlow, mathigh, frame / 60.0 };
+					scene.build(bf);
+
+					pipeline.setDepthbuffer(depthbuffer);
+					pipeline.setColorbuffer(colorbuffer);
+					pipeline.setMaterialStore(materialstore);
+					pipeline.setTextureStore(texturestore);
+					pipeline.setTarget(target.data(), width);
+					pipeline.render();
+
+					const double t1 = timer.time();
+					if (frame < config.warmup) continue;
+					for (int si = 0; si < TELESTAGE_COUNT; si++) {
+						result.samples[si].push_back(telemetry.getStageElapsed(Telestage(si)));
+						result.cpu[si].push_back(telemetry.getStage(Telestage(si)));
+					}
+					result.samples[TELESTAGE_COUNT].push_back((t1 - t0) * 1000);
+				}
+
+				cout << format("%-10s %4dx%-4d %2d threads:") % scene.name % width % height % threads;
+				for (int si = 0; si <= TELESTAGE_COUNT; si++) {
+					cout << format("  %s %.3f") % bench_stage_names[si] % percentile(result.samples[si], 50);
+				}
+				result.bin_peak_kb = 0;
+				for (auto& item : telemetry.getCounters()) {
+					if (item.name == "bin_peak_kb") result.bin_peak_kb = item.value;
+				}
+				cout << format("  bins %.0fk") % result.bin_peak_kb;
+				cout << endl;
+
+				// before the pipeline goes, its workers take their counters with them
+				result.has_perf = config.perf && perf_collect(result.perf);
+				if (result.has_perf) {
+					print_perf(result.perf);
+				} else if (config.perf) {
+					cout << "  perf: counters unavailable" << endl;
+				}
+				results.push_back(result);
+
+				if (!config.trace.empty()) {
+					telemetry.writeTrace((format("%s%s_%dx%d_%d.json") % config.trace % scene.name % width % height % threads).str());
+				}
+			}
+		}
+	}
+
+	if (!config.output.empty()) {
+		ofstream f(config.output);
+		f << results_to_json(results, kernels->name);
+		if (!f) {
+			cout << "bench: can't write " << config.output << endl;
+			return 1;
+		}
+	}
+	return 0;
+}
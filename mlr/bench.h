@@ -0,0 +1,60 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include "stdafx.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+
+/*
+ * drives the Pipeline with fixed, scripted scenes and reports per-stage
+ * times (geometry, index_bins, raster, convert) and the frame time as
+ * medians and percentiles, for every combination of resolution and
+ * thread count.  scene time advances by a fixed step per frame, so two
+ * runs render exactly the same frames.
+ *
+ * stage times are elapsed wall time, from the stage's first span on any
+ * worker to its last one, so they compare across thread counts.  stages
+ * interleave (bins are converted as they finish), so they need not add
+ * up to the frame.  the json also has each stage's cpu time, summed over
+ * all workers.  the frame time is wall time as seen by the caller of
+ * render().
+ */
+struct BenchConfig {
+	std::string data;      // data directory, with trailing separator
+	std::string output;    // json results, empty = console only
+	std::string trace;     // chrome trace filename prefix, empty = none
+	std::string scene;     // run just this scene, empty = all
+	std::vector<int> threads;                    // empty = 1, 2, 4 .. cores
+	std::vector<std::pair<int, int>> sizes;
+	int frames;            // measured frames per run
+	int warmup;            // unmeasured frames before them
+	bool perf;             // hardware counters per pipeline phase
+	bool occlusion;        // cull against the previous frame's depth
+	bool prepass;          // depth prepass before shading
+	std::string kernels;   // raster kernels by name, empty = the best for this cpu
+	CpuBindPolicy bind;    // how workers are placed on the machine
+	bool help;             // print the usage and do nothing else
+
+	BenchConfig()
+		:data("data/"), frames(60), warmup(10), perf(false), occlusion(false), prepass(false), bind(CPU_BIND_CORES), help(false) {
+		sizes = { { 640, 360 }, { 1280, 720 }, { 1920, 1080 } };
+	}
+};
+
+bool parse_bench_args(const std::vector<std::string>& args, BenchConfig& config);
+void print_bench_usage();
+
+class BenchApplication {
+public:
+	BenchApplication(const BenchConfig& config) :config(config) {}
+	int run();
+
+private:
+	const BenchConfig config;
+};
+
+#endif //__BENCH_H
@@ -0,0 +1,177 @@
+#ifndef __BINARENA_H
+#define __BINARENA_H
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "aligned_allocator.h"
+
+const size_t binarena_block_size = 256 * 1024;
+const size_t binchunk_size = 256;   // bytes per Binlist chunk, four cache lines
+
+
+/*
+ * frame lifetime storage for one Binner.  memory comes in big blocks
+ * that are kept from frame to frame, so reset() is O(1) and, once the
+ * blocks have grown to fit the scene, binning allocates nothing.
+ * sizes are rounded to 64 bytes, which keeps everything aligned for
+ * vec4.
+ */
+class Binarena {
+public:
+	Binarena() :blockpos(0), storepos(0), used_bytes(0), high_water(0) {
+		blocks.push_back(std::make_unique<vectorsse<unsigned char>>(binarena_block_size));
+	}
+	Binarena(const Binarena&) = delete;
+	Binarena& operator=(const Binarena&) = delete;
+
+	void reset() {
+		high_water = std::max(high_water, used_bytes);
+		blockpos = 0;
+		storepos = 0;
+		used_bytes = 0;
+	}
+
+	__forceinline void * alloc(size_t bytes) {
+		bytes = (bytes + 63) & ~size_t(63);
+		_ASSERT(bytes <= binarena_block_size);
+		if (storepos + bytes > binarena_block_size) next_block();
+		void * const ptr = blocks[blockpos]->data() + storepos;
+		storepos += bytes;
+		used_bytes += bytes;
+		return ptr;
+	}
+
+	size_t used() const { return used_bytes; }
+	size_t peak() const { return std::max(high_water, used_bytes); }
+	size_t reserved() const { return blocks.size() * binarena_block_size; }
+
+private:
+	void next_block() {
+		blockpos++;
+		if (blockpos == blocks.size()) {
+			blocks.push_back(std::make_unique<vectorsse<unsigned char>>(binarena_block_size));
+		}
+		storepos = 0;
+	}
+
+	std::vector<std::unique_ptr<vectorsse<unsigned char>>> blocks;
+	size_t blockpos;
+	size_t storepos;
+	size_t used_bytes;
+	size_t high_water;   // most used in any earlier frame
+};
+
+
+/*
+ * append-only list of a bin's entries, in binchunk_size chunks from a
+ * Binarena.  items never move once written.
+ */
+template <typename T>
+class Binlist {
+	static const unsigned capacity = (binchunk_size - 16) / sizeof(T);
+
+	struct Chunk {
+		Chunk * next;
+		unsigned count;
+		T items[capacity];
+	};
+
+public:
+	Binlist() :head(nullptr), tail(nullptr), count(0) {}
+
+	void clear() {
+		head = tail = nullptr;
+		count = 0;
+	}
+
+	__forceinline void push_back(Binarena& arena, const T& item) {
+		if (tail == nullptr || tail->count == capacity) add_chunk(arena);
+		tail->items[tail->count++] = item;
+		count++;
+	}
+
+	unsigned size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	class const_iterator {
+	public:
+		const_iterator(const Chunk * chunk, const unsigned idx) :chunk(chunk), idx(idx) {}
+		__forceinline const T& operator*() const { return chunk->items[idx]; }
+		__forceinline const_iterator& operator++() {
+			if (++idx == chunk->count) {
+				chunk = chunk->next;
+				idx = 0;
+			}
+			return *this;
+		}
+		__forceinline bool operator!=(const const_iterator& other) const {
+			return chunk != other.chunk || idx != other.idx;
+		}
+	private:
+		const Chunk * chunk;
+		unsigned idx;
+	};
+
+	const_iterator begin() const { return const_iterator(head, 0); }
+	const_iterator end() const { return const_iterator(nullptr, 0); }
+
+private:
+	void add_chunk(Binarena& arena) {
+		Chunk * const chunk = static_cast<Chunk*>(arena.alloc(sizeof(Chunk)));
+		chunk->next = nullptr;
+		chunk->count = 0;
+		if (tail == nullptr) {
+			head = chunk;
+		} else {
+			tail->next = chunk;
+		}
+		tail = chunk;
+	}
+
+	Chunk * head;
+	Chunk * tail;
+	unsigned count;
+};
+
+
+/*
+ * items addressed by id, in arena chunks of 2^SHIFT.  the chunk table
+ * keeps its capacity across clear(), so it stops growing too.
+ */
+template <typename T, int SHIFT>
+class Binstore {
+public:
+	Binstore() :count(0) {}
+
+	void clear() {
+		chunks.clear();
+		count = 0;
+	}
+
+	__forceinline unsigned push_back(Binarena& arena, const T& item) {
+		const unsigned idx = count & mask;
+		if (idx == 0) {
+			chunks.push_back(static_cast<T*>(arena.alloc(sizeof(T) << SHIFT)));
+		}
+		new (chunks.back() + idx) T(item);
+		return count++;
+	}
+
+	__forceinline const T& operator[](const unsigned id) const {
+		return chunks[id >> SHIFT][id & mask];
+	}
+
+	unsigned size() const { return count; }
+
+private:
+	static const unsigned mask = (1u << SHIFT) - 1;
+	std::vector<T*> chunks;
+	unsigned count;
+};
+
+#endif //__BINARENA_H
@@ -5,11 +5,15 @@
 #include "stdafx.h"
 
 #include <iostream>
+#include <string>
+#include <vector>
 #include <boost/format.hpp>
 
 #include <Windows.h>
 
+#include "bench.h"
 #include "main.h"
+#include "offline.h"
 #include "utils.h"
 
 using namespace std;
@@ -26,6 +30,33 @@ int hackmode_width = 0;
 
 int _tmain(int argc, _TCHAR* argv[])
 {
+	vector<string> args;
+	for (int i = 1; i < argc; i++) {
+#ifdef _UNICODE
+		args.push_back(ws2s(argv[i]));
+#else
+		args.push_back(argv[i]);
+#endif
+	}
+	if (!args.empty() && args[0] == "--offline") {
+		OfflineConfig config;
+		if (!parse_offline_args(args, config)) {
+			print_offline_usage();
+			return 1;
+		}
+		OfflineApplication offline(config);
+		return offline.run();
+	}
+	if (!args.empty() && args[0] == "--bench") {
+		BenchConfig config;
+		if (!parse_bench_args(args, config)) {
+			print_bench_usage();
+			return 1;
+		}
+		BenchApplication bench(config);
+		return bench.run();
+	}
+
 	bind_to_cpu(0);
 
 /*
@@ -42,9 +42,9 @@ void downsampleCanvas(
 
 	for (int y = 0; y < height >> 1; y++) {
 		for (int x = 0; x < width >> 1; x++) {
-			__m128 rg = _mm_hadd_ps(sx->r, sx->g);
-			__m128 ba = _mm_hadd_ps(sx->b, sx->a);
-			__m128 rgba = _mm_hadd_ps(rg, ba);
+			__m128 rg = hadd(sx->r, sx->g);
+			__m128 ba = hadd(sx->b, sx->a);
+			__m128 rgba = hadd(rg, ba);
 			dx->v = _mm_mul_ps(rgba, _mm_set1_ps(0.25f));
 			sx++;
 			dx++;
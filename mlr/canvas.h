@@ -4,6 +4,8 @@
 
 #include "stdafx.h"
 
+#include <cstring>
+
 #include "aligned_allocator.h"
 #include "PixelToaster.h"
 #include "ryg_srgb.h"
@@ -12,11 +14,17 @@
 
 using namespace PixelToaster;
 
-__declspec(align(16)) struct SOAPixel {
+struct __declspec(align(16)) SOAPixel {
 	__m128 r, g, b, a;
 };
 
 
+// the buffers hold 2x2 quads, and convertCanvas() writes two at a time
+__forceinline bool canvas_size_valid(const int width, const int height) {
+	return width > 0 && height > 0 && width % 4 == 0 && height % 2 == 0;
+}
+
+
 struct SOACanvas {
 	vectorsse<SOAPixel> b; // color buffer
 	int width;
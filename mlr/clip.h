@@ -14,7 +14,6 @@ const unsigned CLIP_TOP    = 1 << 4;
 const unsigned CLIP_FAR    = 1 << 5;
 
 const float GUARDBAND_FACTOR = 2.0f;
-const vec4 GUARDBAND_WWWW(GUARDBAND_FACTOR, GUARDBAND_FACTOR, 1, 0);
 
 //std::array<unsigned, 5> CLIP_LIST = { CLIP_LEFT, CLIP_BOTTOM, CLIP_NEAR, CLIP_RIGHT, CLIP_TOP }; //CLIP_FAR
 
@@ -24,7 +23,8 @@ class Guardband {
 public:
 
 static __forceinline unsigned clipPoint(const vec4& p) {
-	auto www = GUARDBAND_WWWW * p.wwww(); // guardband vector is (gbf,gbf,1,0)
+	const vec4 guardband(GUARDBAND_FACTOR, GUARDBAND_FACTOR, 1, 0);
+	auto www = guardband * p.wwww();
 	auto lbn_mask = cmple(www+p, vec4::zero()).mask() & 0x7; // left, bottom, near
 	auto rtf_mask = cmple(www-p, vec4::zero()).mask() & 0x3;// right, top, far
 	return lbn_mask | (rtf_mask << 3);
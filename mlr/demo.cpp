@@ -8,10 +8,6 @@
 #include <atomic>
 #include <memory>
 
-#include <conio.h>
-
-#include <Windows.h>
-
 #include "main.h"
 #include "tri.h"
 #include "tri_sd.h"
@@ -28,14 +24,7 @@
 using namespace std;
 using boost::format;
 
-SOACanvas rendertarget;
-SOADepth depthtarget;
-
-vectorsse<vec4> colorpack;
-
-Timer gt;
-
-inline static double random()
+inline static double drandom()
 {
 	// Custom random number generator...
 	static unsigned seed1 = 0x23125253;
@@ -46,12 +35,10 @@ inline static double random()
 }
 
 inline static float frandom() {
-	return static_cast<float>(random());
+	return static_cast<float>(drandom());
 }
 
-int matlow, mathigh;
-
-Demo::Demo(Rocket& rocket, TextureStore& texturestore, MeshStore& meshstore, MaterialStore& materialstore, Telemetry& telemetry) :
+Demo::Demo(Rocket& rocket, TextureStore& texturestore, MeshStore& meshstore, MaterialStore& materialstore, Telemetry& telemetry, const int threads, const int first_cpu) :
 	config_width(0),
 	config_height(0),
 	rocket(rocket),
@@ -59,7 +46,7 @@ Demo::Demo(Rocket& rocket, TextureStore& texturestore, MeshStore& meshstore, Mat
 	texturestore(texturestore),
 	materialstore(materialstore),
 	telemetry(telemetry),
-	pipeline(get_cpu_count(), telemetry)
+	pipeline(threads, first_cpu, telemetry)
 {
 	fs_init();
 
@@ -69,15 +56,26 @@ Demo::Demo(Rocket& rocket, TextureStore& texturestore, MeshStore& meshstore, Mat
 		colorpack.push_back(vec4(frandom(), frandom(), frandom(), 0));
 	}
 
-	matlow = materialstore.store.size();
-	for (int i = 0; i < 3; i++) {
-		Material m;
-		m.imagename = "";
-		float intensity = frandom() * 128;
-		m.kd = vec3(frandom(), frandom(), frandom()) * vec3(intensity);
-		materialstore.store.push_back(m);
+	/*
+	 * the random materials are named, so that further Demo instances
+	 * sharing the store pick up the same ones instead of adding more
+	 */
+	const auto& store = materialstore.store;
+	const auto first = find_if(store.begin(), store.end(), [](const Material& m) { return m.name == "demo_random_0"; });
+	if (first != store.end()) {
+		matlow = first - store.begin();
+	} else {
+		matlow = store.size();
+		for (int i = 0; i < 3; i++) {
+			Material m;
+			m.name = (format("demo_random_%d") % i).str();
+			m.imagename = "";
+			float intensity = frandom() * 128;
+			m.kd = vec3(frandom(), frandom(), frandom()) * vec3(intensity);
+			materialstore.store.push_back(m);
+		}
 	}
-	mathigh = materialstore.store.size()-1;
+	mathigh = matlow + 2;
 }
 
 Demo::~Demo()
@@ -94,8 +92,10 @@ void Demo::render(
 	const double ui_time
 )
 {
-	if (target_width != config_width || target_height != config_height)
+	if (target_width != config_width || target_height != config_height) {
+		pipeline.flush(); // a pending frame still targets the old buffers
 		on_resize(target_width, target_height);
+	}
 
 	fs_reset();
 
@@ -111,15 +111,12 @@ void Demo::render(
 	auto cubescale_y = rocket.getf("cubescale_y");
 	auto cubescale_z = rocket.getf("cubescale_z");
 	auto cubescale = vec3(cubescale_x, cubescale_y, cubescale_z);
-	Viewport vp(config_width, config_height, float(config_width) / float(config_height), zorp);
-
-	vec4 light_pos(50,50,10,1);
-	pipeline.addLight({ light_pos, vec4(1, 1, 1, 0), 100.0f, vec4(1, 1, 1, 0), 0, true });
+	Viewport vp(float(config_width) / float(config_height), zorp);
 
 	telemetry.mark(0);
 
 	pipeline.reset(config_width, config_height);
-	pipeline.setViewport(&vp);
+	pipeline.setViewdevice(viewdevice.get());
 
 //	auto cm = mat4_look_from_to(vec4(0, 0, 30, 1), vec4(0, 0, 0, 1));
 //	auto cm = mat4::ident();
@@ -127,6 +124,9 @@ void Demo::render(
 //	pipeline.addCamera(mat4_translate(vec3(0, 0, 100)));
 	pipeline.addCamera(ui_camera);
 
+	vec4 light_pos(50,50,10,1);
+	pipeline.addLight({ light_pos, vec4(1, 1, 1, 0), 100.0f, vec4(1, 1, 1, 0), 0, true });
+
 	//auto themesh = meshstore.find_by_name("textest1.obj");
 	auto themesh = meshstore.find("cube1x1.obj");
 
@@ -155,7 +155,7 @@ void Demo::render(
 	stack.push_back(make_unique<MeshyTranslate>(previous_op, mat4::rotate_y(3.14/2)));
 	stack.push_back(make_unique<MeshyTranslate>(previous_op, mat4::position(vec3(0,0,500+(fract(T*mov_x)-0)*500))));
 	stack.push_back(make_unique<MeshyMaterial> (previous_op, matlow, mathigh));
-	pipeline.addMeshy(previous_op);
+	pipeline.addMeshy(previous_op, &vp);
 
 	auto tiles = meshstore.find("tiles1.obj");
 	stack.push_back(make_unique<MeshySet>      (&tiles,      mat4::rotate_x(3.14 / 2.0f)));
@@ -192,6 +192,7 @@ void Demo::on_resize(const int new_x, const int new_y)
 	config_height = new_y;
 	rendertarget.setup(config_width, config_height);
 	depthtarget.setup(config_width, config_height);
+	viewdevice = make_unique<Viewdevice>(config_width, config_height);
 	wholescreen.x0 = 0;
 	wholescreen.y0 = 0;
 	wholescreen.x1 = config_width;
@@ -4,9 +4,13 @@
 
 #include "stdafx.h"
 
+#include <memory>
+
 #include "PixelToaster.h"
 
+#include "canvas.h"
 #include "render.h"
+#include "viewport.h"
 
 class Demo
 {
@@ -16,7 +20,9 @@ public:
 		class TextureStore& texturestore,
 		class MeshStore& meshstore,
 		class MaterialStore& materialstore,
-		class Telemetry& telemetry
+		class Telemetry& telemetry,
+		const int threads,
+		const int first_cpu
 	);
 	~Demo();
 	void render(
@@ -27,6 +33,8 @@ public:
 		const mat4& ui_camera,
 		const double ui_time
 	);
+	void setPipelineMode(const PipelineMode mode) { pipeline.setMode(mode); }
+	void flush() { pipeline.flush(); }
 
 private:
 	void on_resize(const int new_width, const int new_height);
@@ -44,6 +52,13 @@ private:
 
 	class Pipeline pipeline;
 
+	SOACanvas rendertarget;
+	SOADepth depthtarget;
+	std::unique_ptr<Viewdevice> viewdevice;
+
+	vectorsse<vec4> colorpack;
+	int matlow, mathigh;
+
 };
 
 #endif //__DEMO_H
@@ -6,6 +6,8 @@
 
 #include "vec_soa.h"
 #include "canvas.h"
+#include "tri.h"
+#include "vec8.h"
 
 class FlatShader {
 public:
@@ -34,7 +36,7 @@ public:
 	}
 
 	void setColor(const vec4& color) {
-		face_color.set(color);
+		face_color.fill(color);
 	}
 
 	void setup(const int width, const int height, const vec4& s1, const vec4& s2, const vec4& s3) {
@@ -56,6 +58,14 @@ public:
 		};
 	}
 
+	// the same from a triangle set up at bin time
+	void setup(const int width, const int height, const TriSetup& ts) {
+		this->width = width;
+		this->height = height;
+		vert_invw.set(ts.invw.xxxx(), ts.invw.yyyy(), ts.invw.zzzz());
+		vert_depth.set(ts.depth.xxxx(), ts.depth.yyyy(), ts.depth.zzzz());
+	}
+
 	__forceinline void goto_xy(int x, int y) {
 		offs_left_start = (y >> 1)*(width >> 1) + (x >> 1);
 		offs = offs_left_start;
@@ -91,13 +101,18 @@ public:
 		selectbits(old_depth, new_depth, mask).store(dbx);
 	}
 
+	// nearer is larger, and the later of two equal depths wins
+	virtual __forceinline ivec4 depthtest(const qfloat& frag_depth, const qfloat& old_depth) const {
+		return float2bits(cmpge(frag_depth, old_depth));
+	}
+
 	virtual __forceinline void render(const qfloat2& frag_coord, const ivec4& trimask, const vertex_float& BS) {
 
 		qfloat frag_depth = vertex_blend(BS, vert_depth);
 
 		// read depth buffer
 		qfloat old_depth(vec4::load(db + offs));
-		ivec4 depthmask = float2bits(cmpge(frag_depth, old_depth));
+		ivec4 depthmask = depthtest(frag_depth, old_depth);
 		ivec4 frag_mask = andnot(trimask, depthmask);
 //		ivec4 frag_mask = andnot(trimask, ivec4(-1,-1,-1,-1)); // depthmask);
 
@@ -121,16 +136,134 @@ public:
 		frag_color.set(color3);
 //		frag_color.set(face_color);
 	}
+
+#ifdef __AVX2__
+	/*
+	 * render() for the quads at offs and offs + 1, in the halves of the
+	 * octet.  a shader that overrides fragment() has to override
+	 * fragment8() as well, fragment_by_quad() will do, and one that
+	 * overrides render() or colorout() their 8-wide ones.
+	 */
+	virtual __forceinline void render8(const ofloat2& frag_coord, const ivec8& trimask, const vertex_float8& BS) {
+
+		ofloat frag_depth = vertex_blend(BS, vert_depth);
+
+		ofloat old_depth(vec8::load(db + offs));
+		ivec8 depthmask = depthtest8(frag_depth, old_depth);
+		ivec8 frag_mask = andnot(trimask, depthmask);
+
+		ofloat frag_w = vec8(1.0f) / vertex_blend(BS, vert_invw);
+		vertex_float8 BP;
+		BP.x[0] = vec8::twice(vert_invw.x[0]) * BS.x[0] * frag_w;
+		BP.x[1] = vec8::twice(vert_invw.x[1]) * BS.x[1] * frag_w;
+		BP.x[2] = vec8(1.0f) - (BP.x[0] + BP.x[1]);
+
+		ofloat4 frag_color;
+		fragment8(frag_color, frag_mask, frag_coord, frag_depth, BS, BP);
+		colorout8(frag_color, frag_mask);
+		selectbits(old_depth, frag_depth, frag_mask).store(db + offs);
+	}
+
+	virtual __forceinline ivec8 depthtest8(const ofloat& frag_depth, const ofloat& old_depth) const {
+		return float2bits(cmpge(frag_depth, old_depth));
+	}
+
+	virtual __forceinline void colorout8(const ofloat4& n, const ivec8& mask) const {
+		auto cbx = cb+offs;
+		const vec8 r = selectbits(vec8(vec4::load(&cbx[0].r), vec4::load(&cbx[1].r)), n.v[0], mask);
+		const vec8 g = selectbits(vec8(vec4::load(&cbx[0].g), vec4::load(&cbx[1].g)), n.v[1], mask);
+		const vec8 b = selectbits(vec8(vec4::load(&cbx[0].b), vec4::load(&cbx[1].b)), n.v[2], mask);
+		r.lo().store(&cbx[0].r);  r.hi().store(&cbx[1].r);
+		g.lo().store(&cbx[0].g);  g.hi().store(&cbx[1].g);
+		b.lo().store(&cbx[0].b);  b.hi().store(&cbx[1].b);
+	}
+
+	virtual __forceinline void fragment8(ofloat4& frag_color, ivec8& frag_mask, const ofloat2& frag_coord, const ofloat& frag_depth, const vertex_float8& BS, const vertex_float8& BP) const {
+		ofloat3 color3;
+		color3.fill(face_color);
+		frag_color.set(color3 * frag_depth);
+	}
+
+	// fragment8() as two calls of fragment()
+	__forceinline void fragment_by_quad(ofloat4& frag_color, ivec8& frag_mask, const ofloat2& frag_coord, const ofloat& frag_depth, const vertex_float8& BS, const vertex_float8& BP) const {
+		qfloat4 lo, hi;
+		ivec4 mask_lo = frag_mask.lo(), mask_hi = frag_mask.hi();
+		fragment(lo, mask_lo, frag_coord.lo(), frag_depth.lo(), BS.lo(), BP.lo());
+		fragment(hi, mask_hi, frag_coord.hi(), frag_depth.hi(), BS.hi(), BP.hi());
+		frag_color.set(lo, hi);
+		frag_mask = ivec8(mask_lo, mask_hi);
+	}
+
+	// texunit at the octet's uvs, each quad on its own for its own mip level
+	template <typename TEXTURE_UNIT>
+	__forceinline void sample_by_quad(const TEXTURE_UNIT& texunit, ofloat4& frag_color, const vertex_float8& BP, const vertex_float2& vert_uv) const {
+		const ofloat2 frag_uv = vertex_blend(BP, vert_uv);
+		qfloat4 lo, hi;
+		texunit.sample(frag_uv.lo(), lo);
+		texunit.sample(frag_uv.hi(), hi);
+		frag_color.set(lo, hi);
+	}
+
+protected:
+	// colorout8() through colorproc(), a quad at a time, for shaders that blend
+	__forceinline void colorout_by_quad(const ofloat4& n, const ivec8& mask) const {
+		const qfloat4 n2[2] = { n.lo(), n.hi() };
+		const ivec4 mask2[2] = { mask.lo(), mask.hi() };
+		for (int i = 0; i < 2; i++) {
+			auto cbx = cb+offs+i;
+			colorproc(vec4::load(&cbx->r), n2[i].v[0], n2[i].v[3], mask2[i]).store(&cbx->r);
+			colorproc(vec4::load(&cbx->g), n2[i].v[1], n2[i].v[3], mask2[i]).store(&cbx->g);
+			colorproc(vec4::load(&cbx->b), n2[i].v[2], n2[i].v[3], mask2[i]).store(&cbx->b);
+		}
+	}
+#endif
 };
 
+/*
+ * the depth test and write of FlatShader and nothing else, for a
+ * prepass ahead of the shaders proper
+ */
 class DepthOnly : public FlatShader {
 public:
-	virtual __forceinline void render(const int x, const int y, const ivec4& trimask, const vertex_float& BS) const {
+	virtual __forceinline void render(const qfloat2& frag_coord, const ivec4& trimask, const vertex_float& BS) {
 		qfloat frag_depth = vertex_blend(BS, vert_depth);
 		qfloat old_depth(vec4::load(db + offs));
-		qfloat new_depth = vmax(frag_depth, old_depth);
-		new_depth.store(db + offs);
+		ivec4 frag_mask = andnot(trimask, depthtest(frag_depth, old_depth));
+		depthwrite(old_depth, frag_depth, frag_mask);
+	}
+#ifdef __AVX2__
+	virtual __forceinline void render8(const ofloat2& frag_coord, const ivec8& trimask, const vertex_float8& BS) {
+		ofloat frag_depth = vertex_blend(BS, vert_depth);
+		ofloat old_depth(vec8::load(db + offs));
+		ivec8 frag_mask = andnot(trimask, depthtest8(frag_depth, old_depth));
+		selectbits(old_depth, frag_depth, frag_mask).store(db + offs);
+	}
+#endif
+};
+
+
+/*
+ * SHADER after a DepthOnly prepass over the same triangles: a fragment
+ * passes only where its depth is the one left in the buffer, so each
+ * pixel is shaded by the triangles that end up in front, and of those
+ * the last one drawn wins, as it would have without the prepass.  the
+ * depths compare equal because both passes blend them from the same
+ * TriSetup with the same barycentrics.
+ */
+template <typename SHADER>
+class DepthEqual : public SHADER {
+public:
+	using SHADER::SHADER;
+	DepthEqual(const SHADER& shader) : SHADER(shader) {}
+
+	virtual __forceinline ivec4 depthtest(const qfloat& frag_depth, const qfloat& old_depth) const {
+		return float2bits(cmpeq(frag_depth, old_depth));
+	}
+#ifdef __AVX2__
+	virtual __forceinline ivec8 depthtest8(const ofloat& frag_depth, const ofloat& old_depth) const {
+		return float2bits(cmpeq(frag_depth, old_depth));
 	}
+#endif
 };
 
 class WireShader : public FlatShader {
@@ -141,6 +274,11 @@ public:
 		frag_color.v[0] = frag_color.v[1] = frag_color.v[2] = mix(grey, vec4::zero(), e) * frag_depth * vec4(4.0f);
 
 	}
+#ifdef __AVX2__
+	virtual __forceinline void fragment8(ofloat4& frag_color, ivec8& frag_mask, const ofloat2& frag_coord, const ofloat& frag_depth, const vertex_float8& BS, const vertex_float8& BP) const {
+		fragment_by_quad(frag_color, frag_mask, frag_coord, frag_depth, BS, BP);
+	}
+#endif
 private:
 	__forceinline qfloat edgefactor(const vertex_float& BS) const {
 		static const qfloat thickfactor(1.5f);
@@ -161,6 +299,11 @@ public:
 		qfloat3 color3 = vertex_blend(BS, color);
 		frag_color.set(color3);
 	}
+#ifdef __AVX2__
+	virtual __forceinline void fragment8(ofloat4& frag_color, ivec8& frag_mask, const ofloat2& frag_coord, const ofloat& frag_depth, const vertex_float8& BS, const vertex_float8& BP) const {
+		frag_color.set(vertex_blend(BS, color));
+	}
+#endif
 private:
 	vertex_float3 color;
 };
@@ -370,8 +513,8 @@ struct ts_any_direct_nearest {
 	__forceinline void fetch_texel(const ivec4& x, const ivec4& y, vec4 * const __restrict px) const
 	{
 		for (int i = 0; i < 4; i++) {
-			auto tx = x.v.m128i_i32[i];
-			auto ty = y.v.m128i_i32[i];
+			auto tx = x.si[i];
+			auto ty = y.si[i];
 
 			if (tx>=0 && tx<width && ty>=0 && ty<height) {
 				const int offset = ty*width + tx;
@@ -411,6 +554,11 @@ public:
 		texunit.sample(frag_uv, texpx);
 		frag_color = texpx; // .set(texpx);
 	}
+#ifdef __AVX2__
+	virtual __forceinline void fragment8(ofloat4& frag_color, ivec8& frag_mask, const ofloat2& frag_coord, const ofloat& frag_depth, const vertex_float8& BS, const vertex_float8& BP) const {
+		sample_by_quad(texunit, frag_color, BP, vert_uv);
+	}
+#endif
 };
 
 
@@ -432,6 +580,11 @@ public:
 		texunit.sample(frag_uv, texpx);
 		frag_color = texpx; // .set(texpx);
 	}
+#ifdef __AVX2__
+	virtual __forceinline void fragment8(ofloat4& frag_color, ivec8& frag_mask, const ofloat2& frag_coord, const ofloat& frag_depth, const vertex_float8& BS, const vertex_float8& BP) const {
+		sample_by_quad(texunit, frag_color, BP, vert_uv);
+	}
+#endif
 	virtual __forceinline vec4 colorproc(const vec4& o, const vec4& n, const vec4& alpha, const ivec4& mask) const {
 		//return selectbits(o, n, mask);
 		//return o + (n &bits2float(mask));
@@ -445,6 +598,11 @@ public:
 		colorproc(vec4::load(&cbx->g), n.v[1], n.v[3], mask).store(&cbx->g);
 		colorproc(vec4::load(&cbx->b), n.v[2], n.v[3], mask).store(&cbx->b);
 	}
+#ifdef __AVX2__
+	virtual __forceinline void colorout8(const ofloat4& n, const ivec8& mask) const {
+		colorout_by_quad(n, mask);
+	}
+#endif
 };
 
 
@@ -453,7 +611,7 @@ class TextureShaderAlphaNoZ : public FlatShader {
 public:
 	const TEXTURE_UNIT & texunit;
 	vertex_float2 vert_uv;
-	inline TextureShaderAlpha(const TEXTURE_UNIT& tu) :texunit(tu){}
+	inline TextureShaderAlphaNoZ(const TEXTURE_UNIT& tu) :texunit(tu){}
 
 	void setUV(const vec4& c1, const vec4& c2, const vec4& c3) {
 		vert_uv.fill(c1, c2, c3);
@@ -475,6 +633,14 @@ public:
 		fragment(frag_color, frag_mask, frag_coord, frag_depth, BS, BP);
 		colorout(frag_color, frag_mask);
 	}
+#ifdef __AVX2__
+	virtual __forceinline void render8(const ofloat2& frag_coord, const ivec8& trimask, const vertex_float8& BS) {
+		render(frag_coord.lo(), trimask.lo(), BS.lo());
+		offs++;
+		render(frag_coord.hi(), trimask.hi(), BS.hi());
+		offs--;
+	}
+#endif
 
 	virtual __forceinline void fragment(qfloat4& frag_color, ivec4& frag_mask, const qfloat2& frag_coord, const qfloat& frag_depth, const vertex_float& BS, const vertex_float& BP) const {
 		qfloat2 frag_uv = vertex_blend(BP, vert_uv);
@@ -483,6 +649,11 @@ public:
 		texunit.sample(frag_uv, texpx);
 		frag_color = texpx; // .set(texpx);
 	}
+#ifdef __AVX2__
+	virtual __forceinline void fragment8(ofloat4& frag_color, ivec8& frag_mask, const ofloat2& frag_coord, const ofloat& frag_depth, const vertex_float8& BS, const vertex_float8& BP) const {
+		sample_by_quad(texunit, frag_color, BP, vert_uv);
+	}
+#endif
 	virtual __forceinline vec4 colorproc(const vec4& o, const vec4& n, const vec4& alpha, const ivec4& mask) const {
 		//return selectbits(o, n, mask);
 		//return o + (n &bits2float(mask));
@@ -496,6 +667,11 @@ public:
 		colorproc(vec4::load(&cbx->g), n.v[1], n.v[3], mask).store(&cbx->g);
 		colorproc(vec4::load(&cbx->b), n.v[2], n.v[3], mask).store(&cbx->b);
 	}
+#ifdef __AVX2__
+	virtual __forceinline void colorout8(const ofloat4& n, const ivec8& mask) const {
+		colorout_by_quad(n, mask);
+	}
+#endif
 };
 
 #endif //__FRAGMENT_H
@@ -1,30 +1,68 @@
-
 #include "stdafx.h"
 
+#include <memory>
 #include <vector>
 
 #include "aligned_allocator.h"
+#include "framestack.h"
+
+const size_t block_size = 1024 * 1024;
 
-vectorsse<unsigned char> store;
-int storepos;
+/*
+ * one stack per thread, so that several Demo instances can each own a
+ * render thread (see offline.cpp)
+ */
+thread_local std::vector<std::unique_ptr<vectorsse<unsigned char>>> blocks;
+thread_local size_t blockpos;
+thread_local size_t storepos;
+thread_local int slot_count = 1;
 
 void fs_init()
 {
-	store.resize(1024 * 1024);
+	if (blocks.empty()) {
+		blocks.push_back(std::make_unique<vectorsse<unsigned char>>(block_size));
+	}
+	fs_reset();
 }
 void fs_reset()
 {
+	blockpos = 0;
 	storepos = 0;
 }
 
+void * fs_alloc(const size_t t, const size_t align)
+{
+	auto nextpos = (storepos + align - 1) & ~(align - 1);
+
+	if (nextpos + t > blocks[blockpos]->size()) {
+		// continue in the next block, keeping it around for later frames.
+		// one kept from an earlier frame may be too small for this
+		blockpos++;
+		if (blockpos == blocks.size() || t > blocks[blockpos]->size()) {
+			blocks.insert(blocks.begin() + blockpos, std::make_unique<vectorsse<unsigned char>>(std::max(block_size, t + align)));
+		}
+		nextpos = 0;
+	}
+
+	storepos = nextpos + t;
+	return &(*blocks[blockpos])[nextpos];
+}
+
 void * fs_alloc(const size_t t)
 {
-	auto nextpos = storepos;
+	return fs_alloc(t, 16);
+}
 
-	auto over = t & 0xf;
-	auto addtl = over ? 16 - over : 0;
-	auto amt = t + addtl;
+/*
+ * number of per-thread slots that frame-lifetime objects (the Meshy
+ * ops) need, i.e. the pipeline's worker count
+ */
+void fs_set_threads(const int threads)
+{
+	slot_count = threads;
+}
 
-	storepos += amt;
-	return &store[nextpos];
-}
\ No newline at end of file
+int fs_threads()
+{
+	return slot_count;
+}
@@ -1,4 +1,3 @@
-
 #ifndef __FRAMESTACK_H
 #define __FRAMESTACK_H
 
@@ -7,5 +6,9 @@
 void fs_init();
 void fs_reset();
 void * fs_alloc(const size_t t);
+void * fs_alloc(const size_t t, const size_t align);
+
+void fs_set_threads(const int threads);
+int fs_threads();
 
-#endif //__FRAMESTACK_H
\ No newline at end of file
+#endif //__FRAMESTACK_H
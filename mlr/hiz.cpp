@@ -0,0 +1,140 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#include "vec.h"
+#include "canvas.h"
+#include "hiz.h"
+
+using namespace std;
+
+
+void HiZ::setup(const int width, const int height)
+{
+	if (width == this->width && height == this->height) return;
+	this->width = width;
+	this->height = height;
+
+	levels.clear();
+	const int block = 1 << hiz_block_shift;
+	int lw = (width + block - 1) >> hiz_block_shift;
+	int lh = (height + block - 1) >> hiz_block_shift;
+	while (1) {
+		levels.emplace_back();
+		auto& level = levels.back();
+		level.width = lw;
+		level.height = lh;
+		level.d.resize(lw * lh);
+		if (lw == 1 && lh == 1) break;
+		lw = (lw + 1) >> 1;
+		lh = (lh + 1) >> 1;
+	}
+}
+
+
+/*
+ * the depth buffer holds 2x2 pixel quads, so a block is 4x4 quads,
+ * fewer where it hangs over the edge of the screen
+ */
+void HiZ::reduce(SOADepth& db, const irect& rect)
+{
+	const int quads = 1 << (hiz_block_shift - 1);
+	auto& level = levels[0];
+	const __m128 * const src = db.rawptr();
+
+	for (int by = rect.y0 >> hiz_block_shift; by << hiz_block_shift < rect.y1; by++) {
+		const int qy0 = by * quads;
+		const int qy1 = min(qy0 + quads, (rect.y1 + 1) >> 1);
+		for (int bx = rect.x0 >> hiz_block_shift; bx << hiz_block_shift < rect.x1; bx++) {
+			const int qx0 = bx * quads;
+			const int qx1 = min(qx0 + quads, (rect.x1 + 1) >> 1);
+			vec4 farthest(FLT_MAX);
+			for (int qy = qy0; qy < qy1; qy++) {
+				for (int qx = qx0; qx < qx1; qx++) {
+					farthest = vmin(farthest, vec4::load(src + qy * db.stride + qx));
+				}
+			}
+			farthest = vmin(farthest, vec4(_mm_movehl_ps(farthest.v, farthest.v)));
+			farthest = vmin(farthest, farthest.yyyy());
+			level.d[by * level.width + bx] = farthest.x;
+		}
+	}
+}
+
+
+void HiZ::build()
+{
+	for (size_t li = 1; li < levels.size(); li++) {
+		const auto& below = levels[li - 1];
+		auto& level = levels[li];
+		for (int y = 0; y < level.height; y++) {
+			const int y0 = y * 2, y1 = min(y0 + 1, below.height - 1);
+			for (int x = 0; x < level.width; x++) {
+				const int x0 = x * 2, x1 = min(x0 + 1, below.width - 1);
+				level.d[y * level.width + x] = min(
+					min(below.d[y0 * below.width + x0], below.d[y0 * below.width + x1]),
+					min(below.d[y1 * below.width + x0], below.d[y1 * below.width + x1]));
+			}
+		}
+	}
+}
+
+
+/*
+ * the box is projected to a screen rect and the depth of its nearest
+ * corner.  the rect is looked up on the level where it spans at most
+ * 2x2 texels, and the box is hidden if its nearest point is behind the
+ * farthest depth of all of them.  depths that are equal are not hidden,
+ * as the depth test lets them through, and so an instance can never be
+ * hidden by its own pixels.
+ */
+bool HiZ::occluded(const mat4& to_world, const vec4 * const __restrict corners) const
+{
+	mat4 m;
+	mat4_mul(world_to_screen, to_world, m);
+
+	vec4 lo(FLT_MAX), hi(-FLT_MAX);
+	for (int i = 0; i < 8; i++) {
+		const vec4 p = mat4_mul(m, corners[i]);
+		if (p.w <= 0) return false;   // reaches behind the eye
+		const vec4 s = p / p.wwww();
+		lo = vmin(lo, s);
+		hi = vmax(hi, s);
+	}
+
+	// a pixel more all round for vertices snapped outwards
+	if (lo.x < 1 || lo.y < 1 || hi.x + 1 >= width || hi.y + 1 >= height) return false;
+
+	// as in the shaders, depth = (1 - z) / 2
+	const float nearest = (1.0f - lo.z) * 0.5f;
+
+	int x0 = (int(lo.x) - 1) >> hiz_block_shift, x1 = (int(hi.x) + 1) >> hiz_block_shift;
+	int y0 = (int(lo.y) - 1) >> hiz_block_shift, y1 = (int(hi.y) + 1) >> hiz_block_shift;
+	int li = 0;
+	while (x1 - x0 > 1 || y1 - y0 > 1) {
+		x0 >>= 1;  x1 >>= 1;
+		y0 >>= 1;  y1 >>= 1;
+		li++;
+	}
+	const auto& level = levels[li];
+	const float farthest = min(
+		min(level.d[y0 * level.width + x0], level.d[y0 * level.width + x1]),
+		min(level.d[y1 * level.width + x0], level.d[y1 * level.width + x1]));
+	return nearest < farthest;
+}
+
+
+bool HiZ::occluded_sphere(const mat4& to_world, const vec4& sphere) const
+{
+	const float r = sphere.w;
+	vec4 corners[8];
+	for (int i = 0; i < 8; i++) {
+		corners[i] = vec4(
+			sphere.x + (i & 4 ? r : -r),
+			sphere.y + (i & 2 ? r : -r),
+			sphere.z + (i & 1 ? r : -r),
+			1.0f);
+	}
+	return occluded(to_world, corners);
+}
@@ -0,0 +1,66 @@
+#ifndef __HIZ_H
+#define __HIZ_H
+
+#include "stdafx.h"
+
+#include <vector>
+
+#include "aligned_allocator.h"
+
+#include "vec.h"
+#include "canvas.h"
+
+const int hiz_block_shift = 3;   // level 0 texels are 8x8 pixels
+
+
+/*
+ * depth pyramid of a finished frame, for occlusion culling the next.
+ * a texel is the farthest depth of the pixels under it.  depth buffer
+ * values grow towards the eye, so farthest is smallest: level 0 is the
+ * min over 8x8 pixel blocks, every level above the min over 2x2 texels
+ * of the one below, up to a single texel.
+ *
+ * bounds are tested in the view the depth was drawn with.  that is only
+ * right for the current frame while the eye stays put, and only for
+ * occluders that have not moved since, which is for the pipeline to
+ * decide.
+ */
+class HiZ {
+public:
+	HiZ() :ready(false), width(0), height(0) {}
+
+	void setup(const int width, const int height);
+
+	/*
+	 * level 0 over rect, once its pixels are final.  rects that do not
+	 * share any 8x8 block can be reduced concurrently.
+	 */
+	void reduce(SOADepth& db, const irect& rect);
+
+	// the levels above 0, after all of level 0 is reduced
+	void build();
+
+	/*
+	 * is the box with corners in object space, placed in the world by
+	 * to_world, wholly behind what was drawn?  false unless it can be
+	 * sure: the box must be in front of the eye and on screen.
+	 */
+	bool occluded(const mat4& to_world, const vec4 * const __restrict corners) const;
+
+	// the same for the box around a sphere, radius in w
+	bool occluded_sphere(const mat4& to_world, const vec4& sphere) const;
+
+	mat4 world_to_screen;   // of the frame the depth is from
+	vec4 eye;               // its camera position, in world space
+	bool ready;             // built and not being drawn over
+	int width, height;      // in pixels
+
+private:
+	struct Level {
+		vectorsse<float> d;
+		int width, height;
+	};
+	std::vector<Level> levels;
+};
+
+#endif //__HIZ_H
@@ -0,0 +1,156 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "vec.h"
+#include "render.h"
+#include "xform.h"
+#include "insttree.h"
+
+using namespace std;
+
+// float error in placing and merging spheres must not let them shrink
+const float instance_sphere_slack = 1.0001f;
+
+// an empty lane, outside of every plane
+const vec4 instance_sphere_none(0, 0, 0, -FLT_MAX);
+
+
+void InstanceTree::build(const MeshInstance * const inst, const int count, const vec4& sphere)
+{
+	this->count = count;
+	depth = 0;
+	if (count == 0) return;
+
+	int nodes = count;
+	do {
+		const int blocks = (nodes + 3) / 4;
+		if (int(levels.size()) == depth) levels.emplace_back();
+		levels[depth++].resize(blocks);
+		nodes = blocks;
+	} while (nodes > 1);
+
+	const vec4 center(sphere.x, sphere.y, sphere.z, 1.0f);
+	auto& leaves = levels[0];
+	for (int bi = 0; bi < int(leaves.size()); bi++) {
+		vec4 s[4];
+		for (int k = 0; k < 4; k++) {
+			const int i = bi * 4 + k;
+			if (i >= count) {
+				s[k] = instance_sphere_none;
+				continue;
+			}
+			const mat4& m = inst[i].xform;
+			const vec4 c = mat4_mul(m, center);
+			s[k] = vec4(c.x, c.y, c.z, sphere.w * mat4_max_stretch(m) * instance_sphere_slack);
+		}
+		xform_load(s, leaves[bi]);
+	}
+
+	// a node's sphere holds its children's, centered on their bounds
+	for (int li = 1; li < depth; li++) {
+		const auto& child = levels[li - 1];
+		auto& level = levels[li];
+		for (int bi = 0; bi < int(level.size()); bi++) {
+			vec4 s[4];
+			for (int k = 0; k < 4; k++) {
+				const int ni = bi * 4 + k;
+				if (ni >= int(child.size())) {
+					s[k] = instance_sphere_none;
+					continue;
+				}
+				vec4 cs[4];
+				xform_store(child[ni], cs);
+				vec4 lo(FLT_MAX), hi(-FLT_MAX);
+				for (int ci = 0; ci < 4; ci++) {
+					if (cs[ci].w < 0) continue;
+					const vec4 c(cs[ci].x, cs[ci].y, cs[ci].z, 0);
+					lo = vmin(lo, c - vec4(cs[ci].w));
+					hi = vmax(hi, c + vec4(cs[ci].w));
+				}
+				const vec4 mid = (lo + hi) * 0.5f;
+				float radius = 0;
+				for (int ci = 0; ci < 4; ci++) {
+					if (cs[ci].w < 0) continue;
+					const vec4 c(cs[ci].x, cs[ci].y, cs[ci].z, 0);
+					radius = max(radius, length(c - mid) + cs[ci].w);
+				}
+				s[k] = vec4(mid.x, mid.y, mid.z, radius * instance_sphere_slack);
+			}
+			xform_load(s, level[bi]);
+		}
+	}
+}
+
+
+int InstanceTree::cull(const Viewport& vp, const mat4& camera_inverse, MeshInstance * const inst)
+{
+	if (count == 0) return 0;
+
+	// dot(n, camera_inverse * p) = dot(transpose(camera_inverse) * n, p)
+	for (int fi = 0; fi < 6; fi++) {
+		const vec4& n = vp.frust[fi].n;
+		const Plane world = Plane::from_origin(vec4(
+			dot(n, vec4(camera_inverse.v[0])),
+			dot(n, vec4(camera_inverse.v[1])),
+			dot(n, vec4(camera_inverse.v[2])),
+			dot(n, vec4(camera_inverse.v[3]))));
+		plane[fi][0] = world.n.xxxx();
+		plane[fi][1] = world.n.yyyy();
+		plane[fi][2] = world.n.zzzz();
+		plane[fi][3] = world.n.wwww();
+	}
+
+	out = 0;
+	visit(depth - 1, 0, inst);
+	return out;
+}
+
+
+/*
+ * test the four children in block of level against the frustum.  a
+ * child is out if its sphere is behind any plane, and contained if it
+ * is in front of all of them.
+ */
+void InstanceTree::visit(const int level, const int block, MeshInstance * const inst)
+{
+	const qfloat4& s = levels[level][block];
+	const vec4 negr = -s.v[3];
+	ivec4 outside(0), inside(-1);
+	for (int fi = 0; fi < 6; fi++) {
+		const vec4 d = plane[fi][0] * s.v[0] + plane[fi][1] * s.v[1] + plane[fi][2] * s.v[2] + plane[fi][3];
+		outside |= float2bits(cmplt(d, negr));
+		inside &= float2bits(cmpge(d, s.v[3]));
+	}
+	const int outmask = movemask(bits2float(outside));
+	const int inmask = movemask(bits2float(inside));
+
+	const int span = 1 << (2 * level);   // instances under one node
+	for (int k = 0; k < 4; k++) {
+		if (outmask & (1 << k)) continue;
+		const int node = block * 4 + k;
+		const int begin = node * span;
+		if (inmask & (1 << k)) {
+			emit(begin, min(begin + span, count), true, inst);
+		} else if (level == 0) {
+			emit(begin, begin + 1, false, inst);
+		} else {
+			visit(level - 1, node, inst);
+		}
+	}
+}
+
+
+/*
+ * keep instances [begin, end).  nodes are visited in order, so they
+ * only ever move towards the front.
+ */
+void InstanceTree::emit(const int begin, const int end, const bool contained, MeshInstance * const inst)
+{
+	for (int i = begin; i < end; i++) {
+		if (out != i) inst[out] = inst[i];
+		inst[out++].contained = contained;
+	}
+}
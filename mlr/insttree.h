@@ -0,0 +1,51 @@
+#ifndef __INSTTREE_H
+#define __INSTTREE_H
+
+#include "stdafx.h"
+
+#include <vector>
+
+#include "aligned_allocator.h"
+
+#include "vec.h"
+#include "vec_soa.h"
+#include "viewport.h"
+
+struct MeshInstance;
+
+/*
+ * bounding spheres over one Meshy's flattened instances, rebuilt every
+ * frame.  the tree is 4-ary and follows the order the op chain emitted
+ * the instances in, which is spatially coherent for grids and stacked
+ * multiplies.  each level keeps its spheres in SoA blocks of four, the
+ * children of one node, so a node's children are tested against all
+ * frustum planes in one pass, and a node that is wholly outside or
+ * wholly inside decides for every instance under it.
+ */
+class InstanceTree {
+public:
+	/*
+	 * sphere is the mesh's bounding sphere in object space.  the
+	 * spheres are placed in world space, where the frustum is too.
+	 */
+	void build(const MeshInstance * const inst, const int count, const vec4& sphere);
+
+	/*
+	 * move the instances that may be visible through vp to the front of
+	 * inst, in order, and return how many there are.  instances inside
+	 * every plane are marked contained.
+	 */
+	int cull(const Viewport& vp, const mat4& camera_inverse, MeshInstance * const inst);
+
+private:
+	void visit(const int level, const int block, MeshInstance * const inst);
+	void emit(const int begin, const int end, const bool contained, MeshInstance * const inst);
+
+	std::vector<vectorsse<qfloat4>> levels;   // x, y, z and radius, leaves first
+	int depth;
+	int count;
+	int out;
+	vec4 plane[6][4];   // frustum in world space, components broadcast
+};
+
+#endif //__INSTTREE_H
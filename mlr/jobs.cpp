@@ -0,0 +1,182 @@
+#include "stdafx.h"
+
+#include <thread>
+#include <vector>
+
+#include "jobs.h"
+
+using namespace std;
+
+
+JobSystem::JobSystem(const int threads, function<void(const int)> on_worker_start)
+	:threads(threads), queues(threads), on_worker_start(on_worker_start), pool_used(0), parked(0), started(1)
+{
+	queued = 0;
+	outstanding = 0;
+	quit = false;
+	for (int i = 1; i < threads; i++) {
+		workers.push_back(thread(&JobSystem::workerthread, this, i));
+	}
+
+	// worker 0 is the caller.  hold until every worker has run its hook
+	// so that per-worker state is in place before the first submit()
+	on_worker_start(0);
+	unique_lock<mutex> guard(park_lock);
+	park.wait(guard, [this]{ return started == this->threads; });
+}
+
+
+JobSystem::~JobSystem()
+{
+	{
+		lock_guard<mutex> guard(park_lock);
+		quit = true;
+		park.notify_all();
+	}
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+
+Job* JobSystem::create(function<void(const int)> fn)
+{
+	lock_guard<mutex> guard(pool_lock);
+	if (pool_used == pool.size()) {
+		pool.emplace_back();
+	}
+	Job * const job = &pool[pool_used++];
+	job->fn = fn;
+	job->unfinished = 1;
+	job->dependents.clear();
+	outstanding++;
+	return job;
+}
+
+
+void JobSystem::depends(Job * const job, Job * const on)
+{
+	job->unfinished++;
+	on->dependents.push_back(job);
+}
+
+
+void JobSystem::submit(Job * const job, const int thread_number)
+{
+	if (--job->unfinished == 0) {
+		push(job, thread_number);
+	}
+}
+
+
+void JobSystem::reset()
+{
+	_ASSERT(outstanding == 0);
+	lock_guard<mutex> guard(pool_lock);
+	for (size_t i = 0; i < pool_used; i++) {
+		pool[i].fn = nullptr;
+	}
+	pool_used = 0;
+}
+
+
+void JobSystem::push(Job * const job, const int thread_number)
+{
+	auto& queue = queues[thread_number % threads];
+	queued++;
+	{
+		lock_guard<mutex> guard(queue.lock);
+		queue.jobs.push_back(job);
+	}
+
+	lock_guard<mutex> guard(park_lock);
+	if (parked) park.notify_one();
+}
+
+
+Job* JobSystem::pop(const int thread_number)
+{
+	if (queued == 0) return nullptr;
+
+	{
+		// own work, newest first
+		auto& queue = queues[thread_number];
+		lock_guard<mutex> guard(queue.lock);
+		if (!queue.jobs.empty()) {
+			Job * const job = queue.jobs.back();
+			queue.jobs.pop_back();
+			queued--;
+			return job;
+		}
+	}
+
+	for (int i = 1; i < threads; i++) {
+		// steal, oldest first
+		auto& queue = queues[(thread_number + i) % threads];
+		lock_guard<mutex> guard(queue.lock);
+		if (!queue.jobs.empty()) {
+			Job * const job = queue.jobs.front();
+			queue.jobs.pop_front();
+			queued--;
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+
+void JobSystem::execute(Job * const job, const int thread_number)
+{
+	job->fn(thread_number);
+
+	for (auto dependent : job->dependents) {
+		if (--dependent->unfinished == 0) {
+			push(dependent, thread_number);
+		}
+	}
+
+	if (--outstanding == 0) {
+		lock_guard<mutex> guard(park_lock);
+		park.notify_all();
+	}
+}
+
+
+void JobSystem::wait(const int thread_number)
+{
+	while (outstanding > 0) {
+		Job * const job = pop(thread_number);
+		if (job) {
+			execute(job, thread_number);
+			continue;
+		}
+		unique_lock<mutex> guard(park_lock);
+		parked++;
+		park.wait(guard, [this]{ return outstanding == 0 || queued > 0; });
+		parked--;
+	}
+}
+
+
+void JobSystem::workerthread(const int thread_number)
+{
+	on_worker_start(thread_number);
+	{
+		lock_guard<mutex> guard(park_lock);
+		started++;
+		park.notify_all();
+	}
+
+	while (1) {
+		Job * const job = pop(thread_number);
+		if (job) {
+			execute(job, thread_number);
+			continue;
+		}
+		unique_lock<mutex> guard(park_lock);
+		parked++;
+		park.wait(guard, [this]{ return quit || queued > 0; });
+		parked--;
+		if (quit) break;
+	}
+}
@@ -0,0 +1,86 @@
+#ifndef __JOBS_H
+#define __JOBS_H
+
+#include "stdafx.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "aligned_allocator.h"
+
+/*
+ * a job is a function run by one worker, released once all of the
+ * jobs it depends on have finished.  the function receives the number
+ * of the worker that is running it.
+ */
+struct Job {
+	std::function<void(const int)> fn;
+	std::atomic<int> unfinished;   // open dependencies, +1 until submitted
+	std::vector<Job*> dependents;
+};
+
+
+/*
+ * work-stealing job scheduler.
+ *
+ * every worker owns a deque. the owner pops from the back, idle workers
+ * steal from the front of the other deques, and workers with nothing to
+ * steal park on a condition variable instead of spinning.
+ *
+ * worker 0 is the thread that calls wait(); workers 1..n-1 are owned by
+ * the scheduler.  on_worker_start runs once on every worker, worker 0
+ * included, before the constructor returns.
+ *
+ * jobs live until reset(), which must only be called while idle.
+ * wire up dependencies with depends() before the dependency is
+ * submitted, then submit() everything.
+ */
+class JobSystem {
+public:
+	JobSystem(const int threads, std::function<void(const int)> on_worker_start);
+	~JobSystem();
+
+	Job* create(std::function<void(const int)> fn);
+	void depends(Job * const job, Job * const on);
+	void submit(Job * const job, const int thread_number);
+	void wait(const int thread_number);
+	void reset();
+
+	int size() const { return threads; }
+
+private:
+	struct __declspec(align(64)) WorkQueue {
+		std::mutex lock;
+		std::deque<Job*> jobs;
+	};
+
+	void push(Job * const job, const int thread_number);
+	Job* pop(const int thread_number);
+	void execute(Job * const job, const int thread_number);
+	void workerthread(const int thread_number);
+
+	const int threads;
+	vectorsse<WorkQueue> queues;   // 64 byte aligned, so no two share a line
+	std::vector<std::thread> workers;
+	std::function<void(const int)> on_worker_start;
+
+	std::mutex pool_lock;
+	std::deque<Job> pool;
+	size_t pool_used;
+
+	std::atomic<int> queued;         // jobs sitting in deques
+	std::atomic<int> outstanding;    // jobs created but not yet finished
+	std::atomic<bool> quit;
+
+	std::mutex park_lock;
+	std::condition_variable park;
+	int parked;
+	int started;
+};
+
+#endif //__JOBS_H
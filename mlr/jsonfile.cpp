@@ -3,7 +3,9 @@
 #include <iostream>
 #include <memory>
 
+#ifdef _MSC_VER
 #include <conio.h>
+#endif
 
 #include "utils.h"
 #include "jsonfile.h"
@@ -24,6 +24,12 @@ public:
 		}
 		//		return nullptr;
 	}
+	bool has(const std::string& key) const {
+		for (const auto& item : *jv) {
+			if (key == item->key) return true;
+		}
+		return false;
+	}
 	char* toString() const { return jv->toString(); }
 	double toNumber() const { return jv->toNumber(); }
 	int toInt() const { return static_cast<int>(jv->toNumber()); }
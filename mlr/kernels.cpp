@@ -0,0 +1,99 @@
+#include "stdafx.h"
+
+#include <string>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#include "kernels.h"
+
+using namespace std;
+
+
+static void cpuid(const unsigned leaf, const unsigned subleaf, unsigned r[4])
+{
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuidex(regs, leaf, subleaf);
+	for (int i = 0; i < 4; i++) r[i] = regs[i];
+#else
+	r[0] = r[1] = r[2] = r[3] = 0;
+	if (__get_cpuid_max(0, nullptr) < leaf) return;
+	__cpuid_count(leaf, subleaf, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+
+// the register state the os saves on a context switch
+static unsigned long long xgetbv0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned lo, hi;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+}
+
+
+bool cpu_supports(const KernelTarget target)
+{
+	unsigned r1[4], r7[4];
+	cpuid(1, 0, r1);
+	cpuid(7, 0, r7);
+	const unsigned ecx1 = r1[2], ebx7 = r7[1];
+
+	switch (target) {
+	case KERNEL_SSE2:
+		return true;
+	case KERNEL_SSE41:
+		return (ecx1 & (1 << 0)) != 0 && (ecx1 & (1 << 19)) != 0;   // SSE3, SSE4.1
+	case KERNEL_AVX2:
+		// AVX2 itself, and an os that saves the ymm registers
+		if (!cpu_supports(KERNEL_SSE41)) return false;
+		if ((ecx1 & (1 << 27)) == 0 || (ecx1 & (1 << 28)) == 0) return false;   // OSXSAVE, AVX
+		if ((xgetbv0() & 0x6) != 0x6) return false;   // xmm and ymm state
+		return (ebx7 & (1 << 5)) != 0;
+	}
+	return false;
+}
+
+
+/*
+ * best first.  AVX-512 has no kernels of its own: the wide paths are
+ * 8 lanes, which the AVX2 ones already fill.
+ */
+static const RasterKernels * const all_kernels[] = {
+#ifndef KERNELS_BASELINE_ONLY
+	&kernels_avx2::table,
+	&kernels_sse41::table,
+#endif
+	&kernels_sse2::table,
+};
+
+
+const RasterKernels& raster_kernels()
+{
+	static const RasterKernels& best = [] () -> const RasterKernels& {
+		for (const auto kernels : all_kernels) {
+			if (cpu_supports(kernels->target)) return *kernels;
+		}
+		return kernels_sse2::table;
+	}();
+	return best;
+}
+
+
+const RasterKernels * find_kernels(const string& name)
+{
+	for (const auto kernels : all_kernels) {
+		if (name == kernels->name) {
+			return cpu_supports(kernels->target) ? kernels : nullptr;
+		}
+	}
+	return nullptr;
+}
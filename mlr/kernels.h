@@ -0,0 +1,68 @@
+#ifndef __KERNELS_H
+#define __KERNELS_H
+
+#include "stdafx.h"
+
+#include <string>
+
+#include "canvas.h"
+
+class Pipedata;
+class MaterialStore;
+class TextureStore;
+class Viewdevice;
+
+
+enum KernelTarget {
+	KERNEL_SSE2,    // the baseline, what every x86 with SSE2 runs
+	KERNEL_SSE41,
+	KERNEL_AVX2,    // with the 8-wide paths of tri.h and fragment.h
+};
+
+
+/*
+ * the raster phase, built once for each KernelTarget and chosen at run
+ * time by what the cpu has.  everything else is built for the baseline.
+ *
+ * each kernels_<target>.cpp includes kernels_impl.h with its own
+ * instruction set switched on.  the shaders are included inside a
+ * namespace of the target, so draw_triangle() and the shaders become
+ * distinct functions per target, and the linker can't swap one
+ * target's copy in for another's.  whatever else the kernels use must
+ * be inlined, or else be defined in a baseline file.
+ *
+ * unoptimized builds inline next to nothing, so shared code such as
+ * vector::operator[] or the vec.h operators would come out of a kernel
+ * file and the linker may keep that copy for the whole program.  they
+ * are built with KERNELS_BASELINE_ONLY and without the kernel files
+ * above sse2.  there are no globals with constructors in the headers
+ * for the same reason, they would run before anything is chosen.
+ */
+typedef void (*BinKernel)(Pipedata& pipe, __m128 * __restrict db, SOAPixel * __restrict cb, MaterialStore& materialstore, TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const irect& rect, const int pass);
+
+struct RasterKernels {
+	const char * name;
+	KernelTarget target;
+	BinKernel render;          // Pipedata::render()
+	BinKernel render_depth;    // Pipedata::render(), DEPTH_ONLY
+	BinKernel render_equal;    // Pipedata::render(), DEPTH_EQUAL after render_depth
+	BinKernel render_gltri;    // Pipedata::render_gltri()
+	BinKernel render_rect;     // Pipedata::render_rect()
+	void (*convert)(const irect& rect, const int width, TrueColorPixel * const __restrict tb, SOAPixel * const __restrict sb);
+};
+
+namespace kernels_sse2  { extern const RasterKernels table; }
+namespace kernels_sse41 { extern const RasterKernels table; }
+namespace kernels_avx2  { extern const RasterKernels table; }
+
+
+// can this cpu, and the os, run target's code?
+bool cpu_supports(const KernelTarget target);
+
+// the fastest kernels this cpu runs, looked up on the first call
+const RasterKernels& raster_kernels();
+
+// the kernels named sse2, sse41 or avx2, nullptr if unknown, not built or not supported here
+const RasterKernels * find_kernels(const std::string& name);
+
+#endif //__KERNELS_H
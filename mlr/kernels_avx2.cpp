@@ -0,0 +1,14 @@
+#include "stdafx.h"
+
+/*
+ * built with /arch:AVX2 or -mavx2, for the 8-wide paths
+ */
+#ifndef __AVX2__
+#error "kernels_avx2.cpp needs /arch:AVX2 or -mavx2"
+#endif
+
+#define KERNEL_TARGET KERNEL_AVX2
+#define KERNEL_NAME "avx2"
+#define KERNEL_NAMESPACE kernels_avx2
+
+#include "kernels_impl.h"
@@ -0,0 +1,276 @@
+#ifndef __KERNELS_IMPL_H
+#define __KERNELS_IMPL_H
+
+/*
+ * the raster kernels, for the target of the file including this one:
+ * KERNEL_TARGET is its KernelTarget, KERNEL_NAME what find_kernels()
+ * knows it by and KERNEL_NAMESPACE the namespace of its shaders and
+ * table.  see kernels.h.
+ */
+
+#include "stdafx.h"
+
+#include <string>
+
+#include "vec.h"
+#include "vec_soa.h"
+#include "vec8.h"
+#include "canvas.h"
+#include "tri.h"
+#include "mesh.h"
+#include "render.h"
+#include "texture.h"
+#include "viewport.h"
+#include "kernels.h"
+
+using namespace std;
+
+namespace KERNEL_NAMESPACE {
+
+#include "fragment.h"
+#include "distort.h"
+
+// a type of this namespace, so convertCanvas() is instantiated once per target
+struct Postprocess {
+	__forceinline vec4 proc(const vec4& a) { return a; }
+};
+
+// shader as it is, or testing for the depths a prepass left
+template <typename SHADER>
+__forceinline void draw_shaded(const irect& rect, const TriSetup& ts, SHADER& shader, const DepthPass depth)
+{
+	if (depth == DEPTH_EQUAL) {
+		DepthEqual<SHADER> equal_shader(shader);
+		draw_triangle(rect, ts, equal_shader);
+	}
+	else {
+		draw_triangle(rect, ts, shader);
+	}
+}
+
+}
+
+
+template <>
+void Pipedata::render<KERNEL_TARGET>(__m128 * __restrict db, SOAPixel * __restrict cb, MaterialStore& materialstore, TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const irect& rect, const int pass, const DepthPass depth)
+{
+	using namespace KERNEL_NAMESPACE;
+
+	DepthOnly depth_shader;
+	depth_shader.setDepthBuffer(db);
+
+	FlatShader my_shader;
+	my_shader.setColorBuffer(cb);
+	my_shader.setDepthBuffer(db);
+	my_shader.setColor(vec4(1, 0.66, 0.33, 0));
+
+	WireShader wire_shader;
+	wire_shader.setColorBuffer(cb);
+	wire_shader.setDepthBuffer(db);
+	wire_shader.setColor(vec4(1, 0.66, 0.33, 0));
+
+	auto& bin = binner.bins[bin_idx];
+
+	for (const auto id : bin.tris) {
+
+		const auto& tri = binner.tris[id];
+		const auto& face = tri.face;
+		const auto& ts = tri.setup;
+
+		Material& mat = materialstore.store[face.mf];
+		if (mat.pass != pass) continue;
+
+		if (depth == DEPTH_ONLY) {
+			depth_shader.setup(vpd.width, vpd.height, ts);
+			draw_triangle(rect, ts, depth_shader);
+		}
+		else if (mat.imagename != string("")) {
+			const auto tex = texturestore.find(mat.imagename);
+			const auto texunit = ts_pow2_mipmap<9>(&tex->b[0]);
+			auto tex_shader = TextureShader<ts_pow2_mipmap<9>>(texunit);
+			tex_shader.setColorBuffer(cb);
+			tex_shader.setDepthBuffer(db);
+			tex_shader.setUV(tlst[face.iuv[0]], tlst[face.iuv[1]], tlst[face.iuv[2]]);
+			tex_shader.setup(vpd.width, vpd.height, ts);
+			draw_shaded(rect, ts, tex_shader, depth);
+		}
+		else {
+			if (1) {
+				my_shader.setColor(vec4(mat.kd.x, mat.kd.y, mat.kd.z, 0));
+				my_shader.setup(vpd.width, vpd.height, ts);
+				draw_shaded(rect, ts, my_shader, depth);
+			}
+			else {
+				wire_shader.setColor(vec4(mat.kd.x, mat.kd.y, mat.kd.z, 0));
+				wire_shader.setup(vpd.width, vpd.height, ts);
+				draw_shaded(rect, ts, wire_shader, depth);
+			}
+		}
+
+	}//faces
+}
+
+
+#pragma pack(1)
+struct VertexData {
+	vec4 f;
+	vec4 p;
+	vec4 n;
+	vec4 c;
+	vec4 t;
+};
+#pragma pack()
+
+template <>
+void Pipedata::render_gltri<KERNEL_TARGET>(__m128 * __restrict db, SOAPixel * __restrict cb, MaterialStore& materialstore, TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const irect& rect, const int pass)
+{
+	using namespace KERNEL_NAMESPACE;
+
+	ShadedShader my_shader;
+	my_shader.setColorBuffer(cb);
+	my_shader.setDepthBuffer(db);
+	//	my_shader.setColor(vec4(1, 0.66, 0.33, 0));
+
+	WireShader wire_shader;
+	wire_shader.setColorBuffer(cb);
+	wire_shader.setDepthBuffer(db);
+	wire_shader.setColor(vec4(1, 0.66, 0.33, 0));
+
+	auto& bin = binner.bins[bin_idx];
+
+	for (const auto id : bin.gltris) {
+
+		const auto& tri = binner.gltris[id];
+		bool backfacing = (tri.facedata & 0x80) > 0;
+		int material_id = tri.facedata & 0x7f;
+
+		const auto& v0 = *reinterpret_cast<const VertexData*>(&tri.v[0]);
+		const auto& v1 = *reinterpret_cast<const VertexData*>(&tri.v[5]);
+		const auto& v2 = *reinterpret_cast<const VertexData*>(&tri.v[10]);
+
+		if (backfacing) continue;
+
+		Material& mat = materialstore.store[material_id];
+		if (mat.pass != pass) continue;
+
+		if (mat.imagename != string("")) {
+			const auto tex = texturestore.find(mat.imagename);
+			if (tex->width == 256) {
+				const auto texunit = ts_pow2_direct_nearest<8>(&tex->b[0]);
+				auto tex_shader = TextureShaderAlphaNoZ<ts_pow2_direct_nearest<8>>(texunit);
+				tex_shader.setColorBuffer(cb);
+				tex_shader.setDepthBuffer(db);
+				tex_shader.setUV(v0.t, v1.t, v2.t);
+				tex_shader.setup(vpd.width, vpd.height, tri.setup);
+				draw_triangle(rect, tri.setup, tex_shader);
+			}
+			else if (tex->width == 512) {
+				const auto texunit = ts_pow2_mipmap<9>(&tex->b[0]);
+				auto tex_shader = TextureShader<ts_pow2_mipmap<9>>(texunit);
+				tex_shader.setColorBuffer(cb);
+				tex_shader.setDepthBuffer(db);
+				tex_shader.setUV(v0.t, v1.t, v2.t);
+				tex_shader.setup(vpd.width, vpd.height, tri.setup);
+				draw_triangle(rect, tri.setup, tex_shader);
+			}
+		}
+		else {
+			if (0) {
+				//				my_shader.setColor(vec4(mat.kd.x, mat.kd.y, mat.kd.z, 0));
+				my_shader.setColor(v0.c, v1.c, v2.c);
+				my_shader.setup(vpd.width, vpd.height, tri.setup);
+				draw_triangle(rect, tri.setup, my_shader);
+			}
+			else {
+				wire_shader.setColor(vec4(mat.kd.x, mat.kd.y, mat.kd.z, 0));
+				wire_shader.setup(vpd.width, vpd.height, tri.setup);
+				draw_triangle(rect, tri.setup, wire_shader);
+			}
+		}
+
+	}// gldata
+}
+
+
+template <>
+void Pipedata::render_rect<KERNEL_TARGET>(__m128 * __restrict, SOAPixel * __restrict cb, MaterialStore&, TextureStore& texturestore, const Viewdevice& vpd, const int, const irect& rect, const int pass)
+{
+	using namespace KERNEL_NAMESPACE;
+
+	unsigned di = 0;
+	unsigned fi = 0;
+	while (di < this->rectbyte.size()) {
+
+		int rtype = this->rectbyte[di++];
+		int rvals = this->rectbyte[di++];
+
+		if (rtype == 1) {
+			if (pass != 0) continue;
+			const auto tex = texturestore.find("girl256.png");
+			const auto texunit = ts_any_direct_nearest(&tex->b[0], tex->width, tex->height);
+			DistortShader<ts_any_direct_nearest> the_shader(texunit);
+			//const auto texunit = ts_pow2_direct_nearest<8>(&tex->b[0]);
+			//DistortShader<ts_pow2_direct_nearest<8>> the_shader(texunit);
+			the_shader.setColorBuffer(cb);
+			the_shader.setup(vpd.width, vpd.height);
+			for (int pi=0; pi<rvals; pi++) {
+				const float val = this->rectdata[fi++];
+				the_shader.setParam(pi, val);
+			}
+			draw_rectangle(rect, the_shader);
+		} else if (rtype == 2) {
+			if (pass != 0) continue;
+			const auto tex = texturestore.find("water-girl.png");
+			const auto texunit = ts_any_direct_nearest(&tex->b[0], tex->width, tex->height);
+			OverlayShader<ts_any_direct_nearest> the_shader(texunit);
+			the_shader.setColorBuffer(cb);
+			the_shader.setup(vpd.width, vpd.height, tex->width, tex->height);
+			for (int pi=0; pi<rvals; pi++) {
+				const float val = this->rectdata[fi++];
+				the_shader.setParam(pi, val);
+			}
+			draw_rectangle(rect, the_shader);
+		}
+
+	}//rectbytes
+}
+
+
+namespace KERNEL_NAMESPACE {
+
+static void render(Pipedata& pipe, __m128 * __restrict db, SOAPixel * __restrict cb, MaterialStore& materialstore, TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const irect& rect, const int pass)
+{
+	pipe.render<KERNEL_TARGET>(db, cb, materialstore, texturestore, vpd, bin_idx, rect, pass, DEPTH_TEST);
+}
+
+static void render_depth(Pipedata& pipe, __m128 * __restrict db, SOAPixel * __restrict cb, MaterialStore& materialstore, TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const irect& rect, const int pass)
+{
+	pipe.render<KERNEL_TARGET>(db, cb, materialstore, texturestore, vpd, bin_idx, rect, pass, DEPTH_ONLY);
+}
+
+static void render_equal(Pipedata& pipe, __m128 * __restrict db, SOAPixel * __restrict cb, MaterialStore& materialstore, TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const irect& rect, const int pass)
+{
+	pipe.render<KERNEL_TARGET>(db, cb, materialstore, texturestore, vpd, bin_idx, rect, pass, DEPTH_EQUAL);
+}
+
+static void render_gltri(Pipedata& pipe, __m128 * __restrict db, SOAPixel * __restrict cb, MaterialStore& materialstore, TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const irect& rect, const int pass)
+{
+	pipe.render_gltri<KERNEL_TARGET>(db, cb, materialstore, texturestore, vpd, bin_idx, rect, pass);
+}
+
+static void render_rect(Pipedata& pipe, __m128 * __restrict db, SOAPixel * __restrict cb, MaterialStore& materialstore, TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const irect& rect, const int pass)
+{
+	pipe.render_rect<KERNEL_TARGET>(db, cb, materialstore, texturestore, vpd, bin_idx, rect, pass);
+}
+
+static void convert(const irect& rect, const int width, TrueColorPixel * const __restrict tb, SOAPixel * const __restrict sb)
+{
+	Postprocess pp;
+	convertCanvas(rect, width, tb, sb, pp);
+}
+
+extern const RasterKernels table = { KERNEL_NAME, KERNEL_TARGET, render, render_depth, render_equal, render_gltri, render_rect, convert };
+
+}
+
+#endif //__KERNELS_IMPL_H
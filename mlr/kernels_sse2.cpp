@@ -0,0 +1,10 @@
+#include "stdafx.h"
+
+/*
+ * the baseline kernels, built like the rest of the program
+ */
+#define KERNEL_TARGET KERNEL_SSE2
+#define KERNEL_NAME "sse2"
+#define KERNEL_NAMESPACE kernels_sse2
+
+#include "kernels_impl.h"
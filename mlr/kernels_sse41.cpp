@@ -0,0 +1,18 @@
+#include "stdafx.h"
+
+/*
+ * built with -msse4.1.  msvc has no such switch, its intrinsics are
+ * always there, so vec.h is told here.
+ */
+#ifdef _MSC_VER
+#define VEC_SSE3
+#define VEC_SSE41
+#elif !defined(__SSE4_1__)
+#error "kernels_sse41.cpp needs -msse4.1"
+#endif
+
+#define KERNEL_TARGET KERNEL_SSE41
+#define KERNEL_NAME "sse41"
+#define KERNEL_NAMESPACE kernels_sse41
+
+#include "kernels_impl.h"
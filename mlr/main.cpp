@@ -172,6 +172,17 @@ int Application::run(const bool started_from_gui) {
 	MaterialStore materialstore;
 	TextureStore texturestore;
 
+	JsonFile jsonfile("data\\demo.json");
+	if (jsonfile.root().has("cpu_bind")) {
+		CpuBindPolicy policy;
+		const string bind = jsonfile.root().get("cpu_bind").toString();
+		if (cpu_bind_policy_from_name(bind, policy)) {
+			set_cpu_bind_policy(policy);
+		} else {
+			cout << "cpu_bind " << bind << " in demo.json, must be cores, threads or none" << endl;
+		}
+	}
+
 	Telemetry telemetry(get_cpu_count());
 
 	texturestore.loadDirectory("data\\textures\\");
@@ -183,8 +194,6 @@ int Application::run(const bool started_from_gui) {
 	ProPrinter pp;
 
 
-	JsonFile jsonfile("data\\demo.json");
-
 	Player player(
 		jsonfile.root().get("soundtrack").get("filename").toString(),
 		jsonfile.root().get("soundtrack").get("bpm").toNumber(),
@@ -223,7 +232,7 @@ int Application::run(const bool started_from_gui) {
 	Timer frametimer;	double ax_frame = 0;
 	Timer subtimer;		double ax_prep = 0, ax_framestart = 0, ax_render = 0, ax_end = 0;
 
-	Demo demo(rocket, texturestore, meshstore, materialstore, telemetry);
+	Demo demo(rocket, texturestore, meshstore, materialstore, telemetry, get_cpu_count(), 0);
 
 	while (display.open()) {
 
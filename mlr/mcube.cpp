@@ -16,18 +16,18 @@
 using namespace std;
 
 
-static const vec4 vertex_offset[8] = {
+const vec4 vertex_offset[8] = {
 	{0,0,0,0},{1,0,0,0},{1,1,0,0},{0,1,0,0},
 	{0,0,1,0},{1,0,1,0},{1,1,1,0},{0,1,1,0}
 };
 
-static const int edge_connection[12][2] = {
+const int edge_connection[12][2] = {
 	{0,1}, {1,2}, {2,3}, {3,0},
 	{4,5}, {5,6}, {6,7}, {7,4},
 	{0,4}, {1,5}, {2,6}, {3,7}
 };
 
-static const vec4 edge_direction[12] = {
+const vec4 edge_direction[12] = {
 	{1,0,0,0},{0,1,0,0},{-1,0,0,0},{0,-1,0,0},
 	{1,0,0,0},{0,1,0,0},{-1,0,0,0},{0,-1,0,0},
 	{0,0,1,0},{0,0,1,0},{ 0,0,1,0},{0, 0,1,0}
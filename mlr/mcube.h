@@ -26,12 +26,12 @@ public:
 		target_value = a;
 	}
 
-	void run(Pipedata& pipe, const int thread_number, const int thread_count)
+	void run(Pipedata& pipe, const int slice, const int slices)
 	{
 		auto scale = vec4(step_size, step_size, step_size, 1);
 		auto halfscale = scale * vec4(0.5, 0.5, 0.5, 0);
 
-		for (int ix = thread_number; ix < grid_size; ix+=thread_count)
+		for (int ix = slice; ix < grid_size; ix+=slices)
 		for (int iy = 0; iy < grid_size; iy++) {
 			float ax = 0;
 			for (int iz = 0; iz < grid_size; iz++) {
@@ -1,6 +1,8 @@
 
 #include "stdafx.h"
 
+#include <algorithm>
+#include <cmath>
 #include <map>
 #include <vector>
 #include <string>
@@ -18,7 +20,7 @@ void Mesh::print() const
 {
 	cout << "mesh[" << this->name << "]:" << endl;
 	cout << "  vert(" << this->bvp.size() << "), normal(" << this->bpn.size() << "), uv(" << this->buv.size() << ")" << endl;
-	cout << "  faces(" << this->faces.size() << ")" << endl;
+	cout << "  faces(" << this->faces.size() << "), meshlets(" << this->meshlets.size() << ", " << this->mlvp.size() << " points)" << endl;
 }
 
 void Mesh::calcBounds()
@@ -38,6 +40,13 @@ void Mesh::calcBounds()
 	bbox[5] = { pmax.x, pmin.y, pmax.z, 1 };
 	bbox[6] = { pmax.x, pmax.y, pmin.z, 1 };
 	bbox[7] = { pmax.x, pmax.y, pmax.z, 1 };
+
+	const vec4 center = (pmin + pmax) * 0.5f;
+	float radius = 0;
+	for (auto& item : this->bvp) {
+		radius = max(radius, length(item - center));
+	}
+	sphere = vec4(center.x, center.y, center.z, radius * 1.0001f);
 }
 
 
@@ -147,6 +156,171 @@ void Mesh::assignEdges()
 }
 
 
+/*
+ * greedy clustering.  a meshlet starts at the first face not yet taken
+ * and grows by the neighbouring face that brings in the fewest new
+ * points, until it is full or has no neighbours left.  meshlets are
+ * made at load time, after the materials are rebased.
+ */
+void Mesh::buildMeshlets()
+{
+	meshlets.clear();
+	mlvp.clear();
+	mlpn.clear();
+	mluv.clear();
+	mlfaces.clear();
+
+	const int face_count = faces.size();
+	vector<vector<int>> point_faces(bvp.size());
+	for (int fi = 0; fi < face_count; fi++) {
+		for (int i = 0; i < 3; i++) {
+			point_faces[faces[fi].ivp[i]].push_back(fi);
+		}
+	}
+
+	vector<bool> taken(face_count, false);
+	vector<int> local_vp(bvp.size(), -1);   // index into the meshlet, -1 = not in it
+	vector<int> local_pn(bpn.size(), -1);
+	vector<int> local_uv(buv.size(), -1);
+	vector<int> members, points, normals, uvs, candidates;
+
+	auto new_points = [&](const Face& face) {
+		int cnt = 0;
+		for (int i = 0; i < 3; i++) {
+			const int vi = face.ivp[i];
+			if (local_vp[vi] == -1 && (i == 0 || vi != face.ivp[0]) && (i < 2 || vi != face.ivp[1])) cnt++;
+		}
+		return cnt;
+	};
+
+	vec4 point_sum;
+	auto take = [&](const int fi) {
+		taken[fi] = true;
+		members.push_back(fi);
+		for (int i = 0; i < 3; i++) {
+			const int vi = faces[fi].ivp[i];
+			if (local_vp[vi] != -1) continue;
+			local_vp[vi] = points.size();
+			points.push_back(vi);
+			point_sum += bvp[vi];
+			for (const int nfi : point_faces[vi]) {
+				if (!taken[nfi]) candidates.push_back(nfi);
+			}
+		}
+	};
+
+	// normals and uvs the obj did not have read as zero
+	auto remap = [](const int idx, const vectorsse<vec4>& src, vector<int>& local, vector<int>& used, vectorsse<vec4>& dst, const int base) {
+		if (idx < 0 || idx >= int(src.size())) {
+			dst.push_back(vec4::zero());
+			return int(dst.size()) - 1 - base;
+		}
+		if (local[idx] == -1) {
+			local[idx] = int(dst.size()) - base;
+			dst.push_back(src[idx]);
+			used.push_back(idx);
+		}
+		return local[idx];
+	};
+
+	int seed = 0;
+	while (1) {
+		while (seed < face_count && taken[seed]) seed++;
+		if (seed == face_count) break;
+
+		members.clear();
+		points.clear();
+		candidates.clear();
+		point_sum = vec4::zero();
+		take(seed);
+
+		while (int(members.size()) < meshlet_max_faces) {
+			// fewest new points, then closest to the middle, which keeps
+			// the meshlet round and its bounds tight
+			const vec4 middle = point_sum / float(points.size());
+			int best = -1;
+			int best_new = 4;
+			float best_dist = 0;
+			for (const int fi : candidates) {
+				if (taken[fi]) continue;
+				const int cnt = new_points(faces[fi]);
+				if (cnt > best_new) continue;
+				const Face& face = faces[fi];
+				const vec4 d = bvp[face.ivp[0]] + bvp[face.ivp[1]] + bvp[face.ivp[2]] - middle * 3.0f;
+				const float dist = dot(d, d);
+				if (cnt < best_new || dist < best_dist) {
+					best = fi;
+					best_new = cnt;
+					best_dist = dist;
+				}
+			}
+			if (best == -1 || int(points.size()) + best_new > meshlet_max_vertices) break;
+			take(best);
+			candidates.erase(remove_if(candidates.begin(), candidates.end(), [&](const int fi) { return taken[fi]; }), candidates.end());
+		}
+
+		Meshlet ml;
+		ml.vp_begin = mlvp.size();
+		ml.vp_count = points.size();
+		ml.pn_begin = mlpn.size();
+		ml.uv_begin = mluv.size();
+		ml.face_begin = mlfaces.size();
+
+		vec4 pmin = bvp[points[0]];
+		vec4 pmax = pmin;
+		for (const int vi : points) {
+			mlvp.push_back(bvp[vi]);
+			pmin = vmin(pmin, bvp[vi]);
+			pmax = vmax(pmax, bvp[vi]);
+		}
+
+		normals.clear();
+		uvs.clear();
+		vec4 nsum = vec4::zero();
+		for (const int fi : members) {
+			Face face = faces[fi];
+			for (int i = 0; i < 3; i++) {
+				face.ivp[i] = local_vp[face.ivp[i]];
+				face.ipn[i] = remap(face.ipn[i], bpn, local_pn, normals, mlpn, ml.pn_begin);
+				face.iuv[i] = remap(face.iuv[i], buv, local_uv, uvs, mluv, ml.uv_begin);
+			}
+			mlfaces.push_back(face);
+			nsum += face.n;
+		}
+		ml.face_end = mlfaces.size();
+		ml.pn_count = mlpn.size() - ml.pn_begin;
+		ml.uv_count = mluv.size() - ml.uv_begin;
+
+		const vec4 center = (pmin + pmax) * 0.5f;   // w stays 1
+		float radius = 0;
+		for (const int vi : points) {
+			radius = max(radius, length(bvp[vi] - center));
+		}
+		ml.sphere = vec4(center.x, center.y, center.z, radius * 1.0001f);
+
+		// the cone is only any use if all normals are within 90 degrees of
+		// its axis.  degenerate faces have no normal, and spoil it
+		ml.cone = vec4(0, 0, 0, 2.0f);
+		const float nlen = length(nsum);
+		if (nlen > 0) {
+			const vec4 axis = nsum / nlen;
+			float mindot = 1.0f;
+			for (const int fi : members) {
+				mindot = min(mindot, dot(axis, faces[fi].n));
+			}
+			if (mindot > 0) {
+				ml.cone = vec4(axis.x, axis.y, axis.z, sqrt(1.0f - mindot*mindot));
+			}
+		}
+		meshlets.push_back(ml);
+
+		for (const int vi : points) local_vp[vi] = -1;
+		for (const int ni : normals) local_pn[ni] = -1;
+		for (const int ti : uvs) local_uv[ti] = -1;
+	}
+}
+
+
 void MaterialStore::print() const
 {
 	cout << "----- material pack -----" << endl;
@@ -200,6 +374,7 @@ void MeshStore::loadDirectory(const string& prefix, MaterialStore& materialstore
 
 		for (auto& item : load_mesh.faces)
 			item.mf += material_base_idx;
+		load_mesh.buildMeshlets();
 
 		store.push_back(load_mesh);
 	}
@@ -87,8 +87,26 @@ __forceinline PFace make_tri(
 	return f;
 }
 
+/*
+ * a cluster of neighbouring faces, small enough to be culled as a whole
+ * before any of its vertices are transformed.  it has its own copies of
+ * the points, normals and uvs it uses, and its faces index those.
+ */
+const int meshlet_max_vertices = 64;
+const int meshlet_max_faces = 124;
+
+struct __declspec(align(16)) Meshlet {
+	vec4 sphere;   // bounding sphere, radius in w
+	vec4 cone;     // face normals: unit axis, sine of the largest angle to it in w (> 1 = no cone)
+	int face_begin, face_end;   // into Mesh::mlfaces
+	int vp_begin, vp_count;     // into Mesh::mlvp
+	int pn_begin, pn_count;     // into Mesh::mlpn
+	int uv_begin, uv_count;     // into Mesh::mluv
+};
+
 struct Mesh {
 	vec4 bbox[8];
+	vec4 sphere;   // bounding sphere, radius in w
 
 	vectorsse<vec4> bvp; // vertex points
 	vectorsse<vec4> bvn; // vertex normals
@@ -97,6 +115,12 @@ struct Mesh {
 	vectorsse<vec4> buv; // texture coords
 	vectorsse<Face> faces;
 
+	vectorsse<Meshlet> meshlets;
+	vectorsse<vec4> mlvp;     // meshlet points
+	vectorsse<vec4> mlpn;     // meshlet normals
+	vectorsse<vec4> mluv;     // meshlet texture coords
+	vectorsse<Face> mlfaces;  // faces by meshlet, indices local to it
+
 	std::string name;
 
 	bool solid;
@@ -106,6 +130,7 @@ struct Mesh {
 	void calcBounds();
 	void calcNormals();
 	void assignEdges();
+	void buildMeshlets();
 };
 
 class MeshStore {
@@ -5,6 +5,7 @@
 #include "mesh.h"
 #include "../mtwist/mtwist.h"
 #include "framestack.h"
+#include "perthread.h"
 
 //local rotate x,y,z
 //scale x,y,z
@@ -23,6 +24,13 @@ public:
 	virtual bool shadows_enabled() {
 		return false;
 	}
+	/*
+	 * material forced onto every face of the instance returned by the
+	 * last next(), or -1 to keep the materials of the mesh
+	 */
+	virtual int material(const int) {
+		return -1;
+	}
 	__forceinline void* operator new[]   (size_t x){ return fs_alloc(x); }
 	__forceinline void* operator new     (size_t x){ return fs_alloc(x); }
 	__forceinline void  operator delete[](void*  x) {}
@@ -33,7 +41,7 @@ public:
 class MeshySet : public Meshy {
 public:
 
-	MeshySet(const Mesh * const mesh, mat4& xform) :Meshy(mesh), xform(xform) { }
+	MeshySet(const Mesh * const mesh, const mat4& xform) :Meshy(mesh), xform(xform) { }
 	virtual void begin(const int t){
 		auto& idx = this->idx[t];
 		idx = 0;
@@ -65,8 +73,8 @@ public:
 		}
 	}
 private:
-	std::array<unsigned,16> idx;
-	std::array<unsigned,16> fidx;
+	PerThread<unsigned> idx;
+	PerThread<unsigned> fidx;
 	mat4 xform;
 };
 
@@ -86,6 +94,9 @@ public:
 	virtual bool fnext(const int t, Face& f) {
 		return in.fnext(t, f);
 	}
+	virtual int material(const int t) {
+		return in.material(t);
+	}
 	virtual bool shadows_enabled() {
 		return true;
 	}
@@ -96,7 +107,7 @@ private:
 
 class MeshyTranslate : public Meshy {
 public:
-	MeshyTranslate(Meshy& inmesh, mat4& xform) :Meshy(inmesh.mesh), in(inmesh), xform(xform) { }
+	MeshyTranslate(Meshy& inmesh, const mat4& xform) :Meshy(inmesh.mesh), in(inmesh), xform(xform) { }
 
 	virtual void begin(const int t) {
 		auto& idx = this->idx[t];
@@ -124,17 +135,20 @@ public:
 		auto& idx = this->idx[t];
 		return in.fnext(t, f);
 	}
+	virtual int material(const int t) {
+		return in.material(t);
+	}
 
 private:
 	Meshy& in;
 	mat4 xform;
-	std::array<unsigned,16> idx;
-	std::array<unsigned,16> fidx;
+	PerThread<unsigned> idx;
+	PerThread<unsigned> fidx;
 };
 
 class MeshyMultiply : public Meshy {
 public:
-	MeshyMultiply(Meshy& inmesh, int many, vec3& translate, vec3& scale) :Meshy(inmesh.mesh), in(inmesh), many(many), translate(translate.x,translate.y,translate.z,1), scale(scale.x,scale.y,scale.z,1) {}
+	MeshyMultiply(Meshy& inmesh, int many, const vec3& translate, const vec3& scale) :Meshy(inmesh.mesh), in(inmesh), many(many), translate(translate.x,translate.y,translate.z,1), scale(scale.x,scale.y,scale.z,1) {}
 
 	virtual void begin(const int t) {
 		auto& idx = this->idx[t];
@@ -171,6 +185,9 @@ public:
 		auto& idx = this->idx[t];
 		return in.fnext(t, f);
 	}
+	virtual int material(const int t) {
+		return in.material(t);
+	}
 
 	__forceinline void calc(const int idx, mat4& xform) {
 		auto fidx = vec4{ float(idx), float(idx), float(idx), 1 };
@@ -184,9 +201,9 @@ private:
 	vec4 translate;
 	vec4 scale;
 
-	std::array<mat4,16> xform;
-	std::array<unsigned,16> idx;
-	std::array<unsigned,16> fidx;
+	PerThread<mat4> xform;
+	PerThread<unsigned> idx;
+	PerThread<unsigned> fidx;
 };
 
 class MeshyCenter : public Meshy {
@@ -250,6 +267,9 @@ public:
 		auto& idx = this->idx[t];
 		return in.fnext(t, f);
 	}
+	virtual int material(const int t) {
+		return in.material(t);
+	}
 private:
 	Meshy& in;
 	const bool center_x;
@@ -257,15 +277,15 @@ private:
 	const bool center_z;
 	const bool y_on_floor;
 
-	std::array<mat4,16> xform;
-	std::array<unsigned,16> idx;
-	std::array<unsigned,16> fidx;
+	PerThread<mat4> xform;
+	PerThread<unsigned> idx;
+	PerThread<unsigned> fidx;
 };
 
 
 class MeshyScatter : public Meshy {
 public:
-	MeshyScatter(Meshy& inmesh, int many, vec3& position) :Meshy(inmesh.mesh), in(inmesh), many(many), position({ position.x, position.y, position.z, 1 }) {}
+	MeshyScatter(Meshy& inmesh, int many, const vec3& position) :Meshy(inmesh.mesh), in(inmesh), many(many), position({ position.x, position.y, position.z, 1 }) {}
 
 	virtual void begin(const int t) {
 		auto& idx = this->idx[t];
@@ -302,15 +322,18 @@ public:
 		auto& idx = this->idx[t];
 		return in.fnext(t, f);
 	}
+	virtual int material(const int t) {
+		return in.material(t);
+	}
 
 private:
 	Meshy& in;
 	int many;
 	vec4 position;
 
-	std::array<unsigned,16> idx;
-	std::array<unsigned,16> fidx;
-	std::array<mt_prng, 16> mt;
+	PerThread<unsigned> idx;
+	PerThread<unsigned> fidx;
+	PerThread<mt_prng> mt;
 };
 
 
@@ -344,12 +367,16 @@ public:
 		f.mf = matidx;
 		return alive;
 	}
+	virtual int material(const int t) {
+		auto& idx = this->idx[t];
+		return (idx % (mathigh - matlow + 1)) + matlow;
+	}
 
 private:
 	Meshy& in;
-	std::array<unsigned,16> idx;
-	std::array<unsigned,16> fidx;
-	std::array<unsigned,16> matidx;
+	PerThread<unsigned> idx;
+	PerThread<unsigned> fidx;
+	PerThread<unsigned> matidx;
 	const int matlow;
 	const int mathigh;
 	int matmod;
@@ -359,7 +386,7 @@ private:
 
 class MeshyMultiply2 : public Meshy {
 public:
-	MeshyMultiply2(Meshy& inmesh, int many, vec3& translate, vec3& rotate) :Meshy(inmesh.mesh), in(inmesh), many(many), translate(translate), rotate(rotate) {}
+	MeshyMultiply2(Meshy& inmesh, int many, const vec3& translate, const vec3& rotate) :Meshy(inmesh.mesh), in(inmesh), many(many), translate(translate), rotate(rotate) {}
 
 	virtual void begin(const int t) {
 		auto& idx = this->idx[t];
@@ -397,6 +424,9 @@ public:
 		auto& idx = this->idx[t];
 		return in.fnext(t, f);
 	}
+	virtual int material(const int t) {
+		return in.material(t);
+	}
 
 	__forceinline void calc(const int idx, mat4& xform) {
 		mat4 tr = mat4::position(translate);
@@ -414,9 +444,9 @@ private:
 	vec3 translate;
 	vec3 rotate;
 
-	std::array<mat4,16> xform;
-	std::array<unsigned,16> idx;
-	std::array<unsigned,16> fidx;
+	PerThread<mat4> xform;
+	PerThread<unsigned> idx;
+	PerThread<unsigned> fidx;
 };
 
 #endif //__MESHOPS_H
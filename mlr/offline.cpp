@@ -0,0 +1,313 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "aligned_allocator.h"
+#include "PixelToaster.h"
+
+#include "bench.h"
+#include "canvas.h"
+#include "demo.h"
+#include "jsonfile.h"
+#include "mesh.h"
+#include "offline.h"
+#include "rocket.h"
+#include "stats.h"
+#include "texture.h"
+#include "utils.h"
+
+using namespace std;
+using boost::format;
+
+
+bool parse_offline_args(const vector<string>& args, OfflineConfig& config)
+{
+	for (size_t i = 0; i < args.size(); i++) {
+		const auto& arg = args[i];
+		if (arg == "--offline") continue;
+		if (arg == "--help" || arg == "-h") {
+			config.help = true;
+			return true;
+		}
+
+		if (i + 1 == args.size()) {
+			cout << "offline: missing value for " << arg << endl;
+			return false;
+		}
+		const auto& value = args[++i];
+
+		if (arg == "--data") {
+			config.data = value;
+			if (config.data.back() != '/' && config.data.back() != '\\') config.data += '/';
+		} else if (arg == "--out") {
+			config.output = value;
+		} else if (arg == "--trace") {
+			config.trace = value;
+		} else if (arg == "--start") {
+			config.start = atof(value.c_str());
+		} else if (arg == "--end") {
+			config.end = atof(value.c_str());
+		} else if (arg == "--fps") {
+			config.fps = atof(value.c_str());
+		} else if (arg == "--lanes") {
+			config.lanes = atoi(value.c_str());
+		} else if (arg == "--bind") {
+			CpuBindPolicy policy;
+			if (!cpu_bind_policy_from_name(value, policy)) {
+				cout << "offline: bind must be cores, threads or none" << endl;
+				return false;
+			}
+			config.bind = value;
+		} else if (arg == "--size") {
+			if (sscanf(value.c_str(), "%dx%d", &config.width, &config.height) != 2) {
+				cout << "offline: size must look like 1280x720" << endl;
+				return false;
+			}
+			if (!canvas_size_valid(config.width, config.height)) {
+				cout << "offline: width must be a positive multiple of 4, height of 2" << endl;
+				return false;
+			}
+		} else {
+			cout << "offline: unknown option " << arg << endl;
+			return false;
+		}
+	}
+	return config.fps > 0 && config.end > config.start;
+}
+
+
+void print_offline_usage()
+{
+	cout << "usage: mlr --offline [options]" << endl;
+	cout << "  --data dir       demo data directory (data/)" << endl;
+	cout << "  --out prefix     frame filename prefix (frame_)" << endl;
+	cout << "  --trace file     chrome trace of the first lane" << endl;
+	cout << "  --start seconds  first frame time (0)" << endl;
+	cout << "  --end seconds    end time, exclusive (10)" << endl;
+	cout << "  --fps rate       frames per second (60)" << endl;
+	cout << "  --size WxH       render size (render_size from demo.json)" << endl;
+	cout << "  --lanes n        frames rendered in parallel (auto)" << endl;
+	cout << "  --bind policy    worker placement: cores, threads, none (cpu_bind from demo.json)" << endl;
+	cout << "  --help           this text" << endl;
+}
+
+
+/*
+ * 32bpp uncompressed, top-left origin.  TrueColorPixel is already
+ * stored as bgra, which is what tga wants.
+ */
+void save_tga(const string& filename, const int width, const int height, TrueColorPixel * const pixels)
+{
+	FILE * const f = fopen(filename.c_str(), "wb");
+	if (!f) {
+		cout << "offline: can't write " << filename << endl;
+		return;
+	}
+
+	unsigned char header[18] = { 0 };
+	header[2] = 2;   // uncompressed truecolor
+	header[12] = width & 0xff;
+	header[13] = (width >> 8) & 0xff;
+	header[14] = height & 0xff;
+	header[15] = (height >> 8) & 0xff;
+	header[16] = 32;
+	header[17] = 0x20 | 8; // top-left, 8 alpha bits
+	fwrite(header, 1, sizeof(header), f);
+
+	// the renderer leaves alpha undefined
+	for (int i = 0; i < width*height; i++) {
+		pixels[i].a = 255;
+	}
+	fwrite(pixels, sizeof(TrueColorPixel), width*height, f);
+	fclose(f);
+}
+
+
+/*
+ * what a lane's threads are counted in.  Pipeline::choose_tile_size()
+ * picks from a table running 256x128 to 32x32, starting at the coarsest
+ * size that gives each worker four tiles and moving with the bin stats
+ * after that, so it would follow whatever lane width it was given.
+ * lanes are sized on 128x64 instead, a fixed size from the middle of
+ * that table, two tiles to a thread, so a lane is as wide as a frame
+ * keeps busy without pushing the pipeline to the finest tiles.
+ */
+const int lane_tile_width = 128;
+const int lane_tile_height = 64;
+const int lane_tiles_per_thread = 2;
+
+/*
+ * lanes are independent Demo instances, each on its own block of cpus,
+ * taking frames from a shared counter.  a single frame rarely has
+ * enough tiles to keep a big machine busy, so small resolutions get
+ * many narrow lanes and large ones a few wide ones.
+ */
+int choose_lanes(const int width, const int height, const int frames, const int cores)
+{
+	const int tiles = ((width + lane_tile_width - 1) / lane_tile_width) * ((height + lane_tile_height - 1) / lane_tile_height);
+	const int lane_threads = max(1, min(tiles / lane_tiles_per_thread, cores));
+	return max(1, min(cores / lane_threads, frames));
+}
+
+
+int OfflineApplication::run()
+{
+	MeshStore meshstore;
+	MaterialStore materialstore;
+	TextureStore texturestore;
+
+	texturestore.loadDirectory(config.data + "textures/");
+	meshstore.loadDirectory(config.data + "meshes/", materialstore, texturestore);
+
+	JsonFile jsonfile(config.data + "demo.json");
+	const double bpm = jsonfile.root().get("soundtrack").get("bpm").toNumber();
+	const int rows_per_beat = jsonfile.root().get("soundtrack").get("rows_per_beat").toInt();
+	const double rows_per_second = bpm / 60.0 * rows_per_beat;
+
+	int width = config.width, height = config.height;
+	if (width == 0 || height == 0) {
+		width = jsonfile.root().get("render_size").get("x").toInt();
+		height = jsonfile.root().get("render_size").get("y").toInt();
+		if (!canvas_size_valid(width, height)) {
+			cout << format("offline: render_size %dx%d in demo.json, width must be a positive multiple of 4, height of 2") % width % height << endl;
+			return 1;
+		}
+	}
+
+	string bind = config.bind;
+	if (bind.empty() && jsonfile.root().has("cpu_bind")) {
+		bind = jsonfile.root().get("cpu_bind").toString();
+	}
+	if (!bind.empty()) {
+		CpuBindPolicy policy;
+		if (!cpu_bind_policy_from_name(bind, policy)) {
+			cout << "offline: cpu_bind " << bind << " in demo.json, must be cores, threads or none" << endl;
+			return 1;
+		}
+		set_cpu_bind_policy(policy);
+	}
+
+	const int frames = int((config.end - config.start) * config.fps);
+	const int cores = get_cpu_count();
+	const int lanes = config.lanes > 0 ? min(config.lanes, cores) : choose_lanes(width, height, frames, cores);
+	const int lane_threads = max(1, cores / lanes);
+
+	cout << format("offline: %d frames at %dx%d, %d lanes of %d threads") % frames % width % height % lanes % lane_threads << endl;
+
+	atomic<int> next_frame(0);
+	mutex setup_lock; // Demo setup adds to the shared stores
+
+	auto lane = [&](const int lane_number) {
+		Telemetry telemetry(lane_threads);
+		Rocket rocket(config.data + "sync");
+
+		unique_ptr<Demo> demo;
+		{
+			lock_guard<mutex> guard(setup_lock);
+			demo = make_unique<Demo>(rocket, texturestore, meshstore, materialstore, telemetry, lane_threads, lane_number * lane_threads);
+		}
+		demo->setPipelineMode(PIPELINE_THROUGHPUT);
+
+		/*
+		 * in throughput mode a frame lands in its buffer during the
+		 * following render() call, so alternate two and write the
+		 * previous one once render() returns
+		 */
+		vectorsse<TrueColorPixel> buffers[2] = {
+			vectorsse<TrueColorPixel>(width * height),
+			vectorsse<TrueColorPixel>(width * height)
+		};
+		int pending = -1;
+		int which = 0;
+
+		while (1) {
+			const int frame = next_frame++;
+			if (frame >= frames) break;
+
+			const double t = config.start + frame / config.fps;
+			rocket.update(t * rows_per_second, nullptr, nullptr);
+
+			telemetry.start();
+			demo->render(width, height, width, buffers[which].data(), mat4::ident(), t);
+			telemetry.end();
+
+			if (pending != -1) {
+				save_tga((format("%s%05d.tga") % config.output % pending).str(), width, height, buffers[which ^ 1].data());
+			}
+			pending = frame;
+			which ^= 1;
+		}
+
+		demo->flush();
+		if (pending != -1) {
+			save_tga((format("%s%05d.tga") % config.output % pending).str(), width, height, buffers[which ^ 1].data());
+		}
+		if (lane_number == 0 && !config.trace.empty()) {
+			telemetry.writeTrace(config.trace);
+		}
+	};
+
+	Timer timer;
+	vector<thread> threads;
+	for (int i = 1; i < lanes; i++) {
+		threads.push_back(thread(lane, i));
+	}
+	lane(0);
+	for (auto& item : threads) {
+		item.join();
+	}
+
+	const double elapsed = timer.time();
+	cout << format("offline: %d frames in %.2f s, %.1f fps") % frames % elapsed % (frames / elapsed) << endl;
+	return 0;
+}
+
+
+#ifndef _WIN32
+/*
+ * posix entry point, offline rendering or --bench.  built by the
+ * CMakeLists.txt at the top, with SYNC_PLAYER (tracks come from files,
+ * not from the editor) and PLATFORM_NULL (no display).
+ */
+int main(int argc, char* argv[])
+{
+	const vector<string> args(argv + 1, argv + argc);
+
+	if (!args.empty() && args[0] == "--bench") {
+		BenchConfig config;
+		if (!parse_bench_args(args, config)) {
+			print_bench_usage();
+			return 1;
+		}
+		if (config.help) {
+			print_bench_usage();
+			return 0;
+		}
+		BenchApplication bench(config);
+		return bench.run();
+	}
+
+	OfflineConfig config;
+	if (!parse_offline_args(args, config)) {
+		print_offline_usage();
+		return 1;
+	}
+	if (config.help) {
+		print_offline_usage();
+		return 0;
+	}
+
+	OfflineApplication app(config);
+	return app.run();
+}
+#endif
@@ -0,0 +1,42 @@
+#ifndef __OFFLINE_H
+#define __OFFLINE_H
+
+#include "stdafx.h"
+
+#include <string>
+#include <vector>
+
+/*
+ * headless renderer: plays the sync tracks back at a fixed frame rate
+ * and writes every frame to disk as a numbered tga, as fast as the
+ * machine allows.  no display, no audio.
+ */
+struct OfflineConfig {
+	std::string data;     // data directory, with trailing separator
+	std::string output;   // frame filename prefix
+	std::string trace;    // chrome trace of the first lane, empty = none
+	double start, end;    // seconds
+	double fps;
+	int width, height;    // 0 = render_size from demo.json
+	int lanes;            // frames rendered in parallel, 0 = auto
+	std::string bind;     // cpu binding policy, empty = cpu_bind from demo.json
+	bool help;            // print the usage and do nothing else
+
+	OfflineConfig()
+		:data("data/"), output("frame_"), start(0), end(10), fps(60),
+		 width(0), height(0), lanes(0), help(false) {}
+};
+
+bool parse_offline_args(const std::vector<std::string>& args, OfflineConfig& config);
+void print_offline_usage();
+
+class OfflineApplication {
+public:
+	OfflineApplication(const OfflineConfig& config) :config(config) {}
+	int run();
+
+private:
+	const OfflineConfig config;
+};
+
+#endif //__OFFLINE_H
@@ -0,0 +1,260 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h>
+#endif
+
+#include "perfcount.h"
+
+using namespace std;
+
+
+const char * const perfphase_names[PERFPHASE_COUNT] = {
+	"other", "vertex", "clip", "bin", "raster", "convert"
+};
+const char * const perfcounter_names[PERF_COUNTER_COUNT] = {
+	"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+};
+
+bool perf_wanted = false;
+thread_local bool perf_active = false;
+
+void perf_enable(const bool enable)
+{
+	perf_wanted = enable;
+}
+
+bool perf_enabled()
+{
+	return perf_wanted;
+}
+
+
+#ifdef __linux__
+
+/*
+ * one thread's counter group.  cycles lead the group so that all five
+ * are scheduled onto the pmu together.
+ */
+struct Perfthread {
+	int fd[PERF_COUNTER_COUNT];
+	perf_event_mmap_page * page[PERF_COUNTER_COUNT];
+	int slot[PERF_COUNTER_COUNT];   // position in a group read, -1 = not open
+	int members;
+	bool rdpmc;
+
+	Perfphase phase;
+	uint64_t last[PERF_COUNTER_COUNT];
+	Perftotals totals;
+
+	Perfthread() {
+		for (int ci = 0; ci < PERF_COUNTER_COUNT; ci++) {
+			fd[ci] = -1;
+			page[ci] = nullptr;
+			slot[ci] = -1;
+		}
+		members = 0;
+	}
+	~Perfthread();
+};
+
+mutex perf_lock;
+vector<Perfthread*> perf_threads;
+thread_local unique_ptr<Perfthread> perf_thread;
+
+
+Perfthread::~Perfthread()
+{
+	{
+		lock_guard<mutex> guard(perf_lock);
+		auto it = find(perf_threads.begin(), perf_threads.end(), this);
+		if (it != perf_threads.end()) perf_threads.erase(it);
+	}
+	for (int ci = 0; ci < PERF_COUNTER_COUNT; ci++) {
+		if (page[ci]) munmap(page[ci], sysconf(_SC_PAGESIZE));
+		if (fd[ci] != -1) close(fd[ci]);
+	}
+}
+
+
+int perf_open(const uint32_t type, const uint64_t config, const int group)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = group == -1 ? 1 : 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return int(syscall(__NR_perf_event_open, &attr, 0, -1, group, 0));
+}
+
+
+/*
+ * user space counter read, see the comment on perf_event_mmap_page in
+ * linux/perf_event.h.  fails when the event is not on the pmu right now.
+ */
+__forceinline bool perf_read_rdpmc(const perf_event_mmap_page * const pc, uint64_t& value)
+{
+	uint32_t seq;
+	uint64_t count;
+	do {
+		seq = pc->lock;
+		atomic_signal_fence(memory_order_seq_cst);
+		const uint32_t idx = pc->index;
+		if (!pc->cap_user_rdpmc || idx == 0) return false;
+		int64_t pmc = __rdpmc(idx - 1);
+		const int shift = 64 - pc->pmc_width;
+		pmc = (pmc << shift) >> shift;
+		count = pc->offset + pmc;
+		atomic_signal_fence(memory_order_seq_cst);
+	} while (pc->lock != seq);
+	value = count;
+	return true;
+}
+
+
+void perf_read(Perfthread& t, uint64_t * const values)
+{
+	if (t.rdpmc) {
+		bool ok = true;
+		for (int ci = 0; ci < PERF_COUNTER_COUNT && ok; ci++) {
+			if (t.fd[ci] == -1) {
+				values[ci] = 0;
+			} else {
+				ok = perf_read_rdpmc(t.page[ci], values[ci]);
+			}
+		}
+		if (ok) return;
+	}
+
+	uint64_t buf[1 + PERF_COUNTER_COUNT];
+	if (read(t.fd[PERF_CYCLES], buf, sizeof(uint64_t) * (1 + t.members)) <= 0) {
+		memset(buf, 0, sizeof(buf));
+	}
+	for (int ci = 0; ci < PERF_COUNTER_COUNT; ci++) {
+		values[ci] = t.slot[ci] == -1 ? 0 : buf[1 + t.slot[ci]];
+	}
+}
+
+
+void perf_thread_begin()
+{
+	if (!perf_wanted) return;
+	if (perf_thread) {
+		// e.g. the caller's thread, reused by the next pipeline
+		perf_active = true;
+		return;
+	}
+
+	const uint64_t cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	const struct { uint32_t type; uint64_t config; } events[PERF_COUNTER_COUNT] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cache_read_miss },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache_read_miss },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	};
+
+	auto t = make_unique<Perfthread>();
+	for (int ci = 0; ci < PERF_COUNTER_COUNT; ci++) {
+		t->fd[ci] = perf_open(events[ci].type, events[ci].config, ci == 0 ? -1 : t->fd[0]);
+		if (t->fd[ci] == -1) {
+			if (ci == 0) {
+				static atomic<bool> warned(false);
+				if (!warned.exchange(true)) cout << "perf: no hardware counters (" << strerror(errno) << ")" << endl;
+				return;
+			}
+			continue;
+		}
+		t->slot[ci] = t->members++;
+
+		void * const page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, t->fd[ci], 0);
+		if (page != MAP_FAILED) t->page[ci] = static_cast<perf_event_mmap_page*>(page);
+	}
+
+	t->rdpmc = true;
+	for (int ci = 0; ci < PERF_COUNTER_COUNT; ci++) {
+		if (t->fd[ci] != -1 && !(t->page[ci] && t->page[ci]->cap_user_rdpmc)) t->rdpmc = false;
+	}
+
+	ioctl(t->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	t->phase = PERFPHASE_OTHER;
+	memset(&t->totals, 0, sizeof(t->totals));
+	perf_read(*t, t->last);
+
+	{
+		lock_guard<mutex> guard(perf_lock);
+		perf_threads.push_back(t.get());
+	}
+	perf_thread = move(t);
+	perf_active = true;
+}
+
+
+Perfphase perf_switch(const Perfphase phase)
+{
+	auto& t = *perf_thread;
+	uint64_t now[PERF_COUNTER_COUNT];
+	perf_read(t, now);
+	for (int ci = 0; ci < PERF_COUNTER_COUNT; ci++) {
+		t.totals.count[t.phase][ci] += now[ci] - t.last[ci];
+		t.last[ci] = now[ci];
+	}
+	const Perfphase outer = t.phase;
+	t.phase = phase;
+	return outer;
+}
+
+
+void perf_reset()
+{
+	lock_guard<mutex> guard(perf_lock);
+	for (auto t : perf_threads) {
+		memset(&t->totals, 0, sizeof(t->totals));
+	}
+}
+
+
+bool perf_collect(Perftotals& out)
+{
+	memset(&out, 0, sizeof(out));
+	lock_guard<mutex> guard(perf_lock);
+	for (auto t : perf_threads) {
+		for (int pi = 0; pi < PERFPHASE_COUNT; pi++) {
+			for (int ci = 0; ci < PERF_COUNTER_COUNT; ci++) {
+				out.count[pi][ci] += t->totals.count[pi][ci];
+			}
+		}
+	}
+	return !perf_threads.empty();
+}
+
+#else
+
+void perf_thread_begin() {}
+Perfphase perf_switch(const Perfphase phase) { return PERFPHASE_OTHER; }
+void perf_reset() {}
+bool perf_collect(Perftotals& out)
+{
+	memset(&out, 0, sizeof(out));
+	return false;
+}
+
+#endif
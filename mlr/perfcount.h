@@ -0,0 +1,73 @@
+#ifndef __PERFCOUNT_H
+#define __PERFCOUNT_H
+
+#include "stdafx.h"
+
+#include <cstdint>
+
+/*
+ * optional hardware counters per worker and pipeline phase, from
+ * perf_event_open on linux.  everywhere else, or when the kernel says
+ * no, all of this does nothing.
+ *
+ * phases nest exclusively: an inner Perfscope takes the counts away
+ * from the one around it, so the phases add up to the whole and
+ * PERFPHASE_OTHER holds whatever ran outside of any scope.
+ */
+enum Perfphase {
+	PERFPHASE_OTHER,
+	PERFPHASE_VERTEX,    // vertex transform
+	PERFPHASE_CLIP,      // polygon clipping in addFace
+	PERFPHASE_BIN,       // the rest of the geometry jobs: culling, setup, Binner::insert
+	PERFPHASE_RASTER,    // triangle setup and draw_triangle
+	PERFPHASE_CONVERT,   // convertCanvas
+	PERFPHASE_COUNT
+};
+
+enum Perfcounter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_COUNTER_COUNT
+};
+
+extern const char * const perfphase_names[PERFPHASE_COUNT];
+extern const char * const perfcounter_names[PERF_COUNTER_COUNT];
+
+struct Perftotals {
+	uint64_t count[PERFPHASE_COUNT][PERF_COUNTER_COUNT];
+};
+
+/*
+ * perf_enable() before the pipeline is created, then every worker
+ * calls perf_thread_begin() from its start hook.
+ */
+void perf_enable(const bool enable);
+bool perf_enabled();
+void perf_thread_begin();
+
+// switch the calling thread to phase, returns the phase it was in
+Perfphase perf_switch(const Perfphase phase);
+
+// zero / sum the totals of every thread that has counters
+void perf_reset();
+bool perf_collect(Perftotals& out);
+
+extern thread_local bool perf_active;
+
+class Perfscope {
+public:
+	__forceinline Perfscope(const Perfphase phase) :switched(perf_active) {
+		outer = switched ? perf_switch(phase) : phase;
+	}
+	__forceinline ~Perfscope() {
+		if (switched) perf_switch(outer);
+	}
+private:
+	const bool switched;   // whether counting was on when the scope began
+	Perfphase outer;
+};
+
+#endif //__PERFCOUNT_H
@@ -0,0 +1,109 @@
+#ifndef __PERTHREAD_H
+#define __PERTHREAD_H
+
+#include "stdafx.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include <new>
+#include <vector>
+
+#include "framestack.h"
+#include "utils.h"
+
+const size_t cache_line_size = 64;
+
+
+/*
+ * one T per pipeline worker, each in its own cache line(s).
+ * slots come from the framestack, so this is meant for state with
+ * frame lifetime such as the Meshy op cursors.  the worker count is
+ * whatever the pipeline registered with fs_set_threads().
+ */
+template <typename T>
+class PerThread {
+public:
+	PerThread() :count(fs_threads()) {
+		store = static_cast<unsigned char*>(fs_alloc(stride * count, cache_line_size));
+		for (int i = 0; i < count; i++) {
+			new (store + stride*i) T();
+		}
+	}
+	~PerThread() {
+		for (int i = 0; i < count; i++) {
+			(*this)[i].~T();
+		}
+	}
+	PerThread(const PerThread&) = delete;
+	PerThread& operator=(const PerThread&) = delete;
+
+	__forceinline T& operator[](const int t) {
+		_ASSERT(t < count);
+		return *reinterpret_cast<T*>(store + stride*t);
+	}
+
+	int size() const { return count; }
+
+private:
+	static const size_t stride = (sizeof(T) + cache_line_size - 1) & ~(cache_line_size - 1);
+	unsigned char * store;
+	const int count;
+};
+
+
+/*
+ * one long-lived T per worker, allocated on the worker's numa node.
+ * place() must be called by the worker itself, after it has been
+ * bound to its cpu, so the pages land next to it.  when the os has no
+ * pages to give, the T goes on the ordinary heap instead.
+ */
+template <typename T>
+class WorkerLocal {
+public:
+	WorkerLocal() {}
+	~WorkerLocal() {
+		for (size_t i = 0; i < items.size(); i++) {
+			T * const item = items[i];
+			if (item == nullptr) continue;
+			item->~T();
+			if (on_heap[i]) {
+				_mm_free(item);
+			} else {
+				free_local(item, sizeof(T));
+			}
+		}
+	}
+	WorkerLocal(const WorkerLocal&) = delete;
+	WorkerLocal& operator=(const WorkerLocal&) = delete;
+
+	void resize(const int count) {
+		items.resize(count, nullptr);
+		on_heap.resize(count, 0);
+	}
+	void place(const int worker) {
+		if (items[worker] != nullptr) return;
+		void * mem = alloc_local(sizeof(T));
+		if (mem == nullptr) {
+			mem = _mm_malloc(sizeof(T), cache_line_size);
+			if (mem == nullptr) throw std::bad_alloc();
+			on_heap[worker] = 1;
+		}
+		items[worker] = new (mem) T();
+	}
+
+	__forceinline T& operator[](const int worker) {
+		return *items[worker];
+	}
+	__forceinline const T& operator[](const int worker) const {
+		return *items[worker];
+	}
+
+	int size() const { return items.size(); }
+
+private:
+	std::vector<T*> items;
+	std::vector<char> on_heap;   // from _mm_malloc; char, as workers set these concurrently
+};
+
+#endif //__PERTHREAD_H
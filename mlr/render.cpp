@@ -1,10 +1,10 @@
 
 #include "stdafx.h"
 
+#include <cstdint>
+#include <cstring>
 #include <vector>
 
-#include <Windows.h>
-
 #include "tri.h"
 #include "vec.h"
 #include "clip.h"
@@ -14,18 +14,25 @@
 #include "render.h"
 #include "texture.h"
 #include "viewport.h"
-#include "fragment.h"
-#include "distort.h"
+#include "perfcount.h"
+#include "xform.h"
 
 using namespace std;
 
-const int tile_width_in_subtiles = 16;
-const int tile_height_in_subtiles = 8;
-
-//#define SLEEP_METHOD
-#define SLEEP_METHOD SleepEx(0,true)
-//#define SLEEP_METHOD Sleep(0)
-//#define SLEEP_METHOD Sleep(1)
+/*
+ * tile sizes the pipeline chooses from, coarse to fine.  widths are
+ * multiples of 8, so tiles and strips stay aligned to quads and to the
+ * 4-pixel steps of convertCanvas
+ */
+const int tile_sizes[][2] = {
+	{ 256, 128 },
+	{ 128, 128 },
+	{ 128,  64 },
+	{  64,  64 },
+	{  64,  32 },
+	{  32,  32 },
+};
+const int tile_levels = sizeof(tile_sizes) / sizeof(tile_sizes[0]);
 
 __forceinline vec4 extrude_to_infinity(const vec4& p, const vec4& l)
 {
@@ -42,25 +49,28 @@ struct ShadowMesh {
 	mat4 c2o; // cameraspace-to-objectspace
 };
 
-void Binner::reset(const int width, const int height)
+void Binner::reset(const int width, const int height, const int tile_width, const int tile_height)
 {
-	if (device_width != width  || device_height != height) {
+	if (device_width != width  || device_height != height || tilewidth != tile_width || tileheight != tile_height) {
 		device_width = width;
 		device_height = height;
+		tilewidth = tile_width;
+		tileheight = tile_height;
 		onResize();
 	}
 
 	for (auto& bin : bins) {
 		bin.clear();
 	}
+	tris.clear();
+	gltris.clear();
+	arena.reset();
+	triangles = 0;
 }
 
 
 void Binner::onResize()
 {
-	tilewidth = tile_width_in_subtiles * 8;
-	tileheight = tile_height_in_subtiles * 8;
-
 	device_width_in_tiles = (device_width + tilewidth - 1) / tilewidth;
 	device_height_in_tiles = (device_height + tileheight - 1) / tileheight;
 
@@ -81,38 +91,56 @@ void Binner::onResize()
 }
 
 
-void Binner::insert(const vec4& p1, const vec4& p2, const vec4& p3, const bool backfacing, const PFace& face)
+/*
+ * calls fn(bin) for every bin whose tile the triangle overlaps.
+ *
+ * the bounding box gives the candidate tiles.  along each row of them,
+ * four tiles at a time, a tile is dropped when even its corner furthest
+ * inside one of the edges is outside of it.  tiles are grown by a pixel
+ * so that the rasterizer's fixed point rounding never loses a covered
+ * one; the test only has to be conservative.
+ */
+template <typename FN>
+__forceinline void Binner::for_each_bin(const vec4& p1, const vec4& p2, const vec4& p3, FN fn)
 {
-	auto pmin = vmax(vmin(p1, vmin(p2, p3)), vec4::zero());
-	auto pmax = vmin(vmax(p1, vmax(p2, p3)), device_max);
+	// edge functions as in draw_triangle, >= 0 inside, relative to the
+	// edge's first vertex.  flipped for the other winding, which shadow
+	// triangles may have
+	const float winding = (p3.x - p1.x)*(p2.y - p1.y) - (p3.y - p1.y)*(p2.x - p1.x) < 0 ? -1.0f : 1.0f;
+	const vec4 ex(p1.x, p2.x, p3.x, 0);
+	const vec4 ey(p1.y, p2.y, p3.y, 0);
+	const vec4 ea = vec4(p2.y - p1.y, p3.y - p2.y, p1.y - p3.y, 0) * winding;
+	const vec4 eb = vec4(p1.x - p2.x, p2.x - p3.x, p3.x - p1.x, 0) * winding;
+
+	for_each_bin(vmin(p1, vmin(p2, p3)), vmax(p1, vmax(p2, p3)), ex, ey, ea, eb, vec4::zero(), fn);
+}
 
-	auto x0 = int(pmin._x());
-	auto y0 = int(pmin._y());
-	auto x1 = int(pmax._x()); // trick: set this to pmin._x()
-	auto y1 = int(pmax._y());
 
-	const int ylim = min(y1 / tileheight, device_height_in_tiles - 1);
-	const int xlim = min(x1 / tilewidth, device_width_in_tiles - 1);
+/*
+ * the same for a triangle set up with homogeneous edges, whose vertices
+ * may be anywhere in front of the near plane
+ */
+template <typename FN>
+__forceinline void Binner::for_each_bin(const TriSetup& ts, FN fn)
+{
+	const vec4 ea(ts.hedge[0].a, ts.hedge[1].a, ts.hedge[2].a, 0);
+	const vec4 eb(ts.hedge[0].b, ts.hedge[1].b, ts.hedge[2].b, 0);
+	const vec4 ec(ts.hedge[0].c, ts.hedge[1].c, ts.hedge[2].c, 0);
+	const vec4 pmin(float(ts.minx - 1), float(ts.miny - 1), 0, 0);
+	const vec4 pmax(float(ts.maxx), float(ts.maxy), 0, 0);
 
-	const int tx0 = x0 / tilewidth;
-	for (int ty = y0 / tileheight; ty <= ylim; ty++) {
-		int bin_row_offset = ty * device_width_in_tiles;
-		for (int tx = tx0; tx <= xlim; tx++) {
-			auto& bin = bins[bin_row_offset + tx];
-			bin.faces.push_back(face);
-			bin.vf.push_back(p1);
-			bin.vf.push_back(p2);
-			bin.vf.push_back(p3);
-			bin.backfacing.push_back(backfacing ? 1 : 0);
-		}
-	}
+	for_each_bin(pmin, pmax, vec4::zero(), vec4::zero(), ea, eb, ec, fn);
 }
 
 
-void Binner::insert_shadow(const vec4& p1, const vec4& p2, const vec4& p3)
+/*
+ * edge i is ea[i]*(x - ex[i]) + eb[i]*(y - ey[i]) + ec[i]
+ */
+template <typename FN>
+__forceinline void Binner::for_each_bin(const vec4& bmin, const vec4& bmax, const vec4& ex, const vec4& ey, const vec4& ea, const vec4& eb, const vec4& ec, FN fn)
 {
-	auto pmin = vmax(vmin(p1, vmin(p2, p3)), vec4::zero());
-	auto pmax = vmin(vmax(p1, vmax(p2, p3)), device_max);
+	auto pmin = vmax(bmin, vec4::zero());
+	auto pmax = vmin(bmax, device_max);
 
 	auto x0 = int(pmin._x());
 	auto y0 = int(pmin._y());
@@ -121,20 +149,91 @@ void Binner::insert_shadow(const vec4& p1, const vec4& p2, const vec4& p3)
 
 	const int ylim = min(y1 / tileheight, device_height_in_tiles - 1);
 	const int xlim = min(x1 / tilewidth, device_width_in_tiles - 1);
-
 	const int tx0 = x0 / tilewidth;
-	for (int ty = y0 / tileheight; ty <= ylim; ty++) {
-		int bin_row_offset = ty * device_width_in_tiles;
-		for (int tx = tx0; tx <= xlim; tx++) {
-			auto& bin = bins[bin_row_offset + tx];
-			bin.sv.push_back(p1);
-			bin.sv.push_back(p2);
-			bin.sv.push_back(p3);
+	const int ty0 = y0 / tileheight;
+
+	if (tx0 == xlim && ty0 == ylim) {
+		fn(bins[ty0 * device_width_in_tiles + tx0]);
+		return;
+	}
+
+	const vec4 lane(0, 1, 2, 3);
+
+	for (int ty = ty0; ty <= ylim; ty++) {
+		const int bin_row_offset = ty * device_width_in_tiles;
+
+		const vec4 top(float(ty * tileheight - 1));
+		const vec4 bottom(float((ty + 1) * tileheight));
+		const vec4 yterm = vmax(eb * (top - ey), eb * (bottom - ey)) + ec;
+		const vec4 y_e0 = yterm.xxxx(), y_e1 = yterm.yyyy(), y_e2 = yterm.zzzz();
+
+		for (int tx = tx0; tx <= xlim; tx += 4) {
+			const vec4 left = (vec4(float(tx)) + lane) * float(tilewidth) - 1.0f;
+			const vec4 right = left + float(tilewidth + 1);
+
+			const vec4 e0 = vmax((left - ex.xxxx()) * ea.xxxx(), (right - ex.xxxx()) * ea.xxxx()) + y_e0;
+			const vec4 e1 = vmax((left - ex.yyyy()) * ea.yyyy(), (right - ex.yyyy()) * ea.yyyy()) + y_e1;
+			const vec4 e2 = vmax((left - ex.zzzz()) * ea.zzzz(), (right - ex.zzzz()) * ea.zzzz()) + y_e2;
+			const unsigned outside = cmplt(vmin(e0, vmin(e1, e2)), vec4::zero()).mask();
+
+			const int lanes = min(4, xlim - tx + 1);
+			for (int li = 0; li < lanes; li++) {
+				if (!(outside & (1 << li))) fn(bins[bin_row_offset + tx + li]);
+			}
 		}
 	}
 }
 
 
+/*
+ * a front facing triangle inside the guard band, set up already from
+ * its device space vertices p1, p2, p3
+ */
+void Binner::insert(const Bintri& tri, const vec4& p1, const vec4& p2, const vec4& p3)
+{
+	triangles++;
+	const unsigned id = tris.push_back(arena, tri);
+
+	for_each_bin(p1, p2, p3, [this, id](Tilebin& bin) {
+		bin.tris.push_back(arena, id);
+	});
+}
+
+
+/*
+ * insert() for a triangle past the guard band, from its vertices as
+ * clip_to_screen() leaves them.  nothing is clipped but the near plane,
+ * which the caller has done already.
+ */
+void Binner::insert_homogeneous(const vec4& h1, const vec4& h2, const vec4& h3, const PFace& face)
+{
+	Bintri tri;
+	const vec4 p1 = h1 / h1.wwww(), p2 = h2 / h2.wwww(), p3 = h3 / h3.wwww();
+	if (!tri.setup.setup_homogeneous(h1, h2, h3,
+		vec4(p1.x, p1.y, p1.z, 1.0f / h1.w),
+		vec4(p2.x, p2.y, p2.z, 1.0f / h2.w),
+		vec4(p3.x, p3.y, p3.z, 1.0f / h3.w))) return;
+
+	triangles++;
+	tri.face = face;
+	const unsigned id = tris.push_back(arena, tri);
+
+	for_each_bin(tri.setup, [this, id](Tilebin& bin) {
+		bin.tris.push_back(arena, id);
+	});
+}
+
+
+void Binner::insert_shadow(const vec4& p1, const vec4& p2, const vec4& p3)
+{
+	for_each_bin(p1, p2, p3, [&](Tilebin& bin) {
+		bin.sv.push_back(arena, p1);
+		bin.sv.push_back(arena, p2);
+		bin.sv.push_back(arena, p3);
+	});
+}
+
+
 void Binner::insert_gltri(
 	const Viewport& vp,
 	const Viewdevice& vpd,
@@ -143,89 +242,155 @@ void Binner::insert_gltri(
 	const vec4 * const pc,
 	const vec4 * const pt,
 	int i0, int i1, int i2,
-	const int material_id
+	const int material_id,
+	const bool beyond_guardband
 )
 {
 	auto p1 = vpd.clip_to_device(vp.eye_to_clip(pv[i0]));
 	auto p2 = vpd.clip_to_device(vp.eye_to_clip(pv[i1]));
 	auto p3 = vpd.clip_to_device(vp.eye_to_clip(pv[i2]));
 
-	const auto d31 = p3 - p1;
-	const auto d21 = p2 - p1;
-	const float area = d31.x*d21.y - d31.y*d21.x;
-	auto backfacing = area < 0;
-	if (backfacing) return; // cull
-	/*
-	if (backfacing) {
-		std::swap(p1, p3);
-		std::swap(i0, i2);
-	}
-	*/
-
-	auto pmin = vmax(vmin(p1, vmin(p2, p3)), vec4::zero());
-	auto pmax = vmin(vmax(p1, vmax(p2, p3)), device_max);
-
-	auto x0 = int(pmin._x());
-	auto y0 = int(pmin._y());
-	auto x1 = int(pmax._x()); // trick: set this to pmin._x()
-	auto y1 = int(pmax._y());
-
-	const int ylim = min(y1 / tileheight, device_height_in_tiles - 1);
-	const int xlim = min(x1 / tilewidth, device_width_in_tiles - 1);
-
-	const int tx0 = x0 / tilewidth;
-	for (int ty = y0 / tileheight; ty <= ylim; ty++) {
-		int bin_row_offset = ty * device_width_in_tiles;
-		for (int tx = tx0; tx <= xlim; tx++) {
-			auto& bin = bins[bin_row_offset + tx];
-
-			unsigned char facedata = material_id;
-			if (backfacing) facedata |= 0x80;
-			bin.glface.push_back(facedata);
-
-			bin.gldata.push_back(p1);
-			bin.gldata.push_back(pv[i0]);
-			bin.gldata.push_back(pn[i0]);
-			bin.gldata.push_back(pc[i0]);
-			bin.gldata.push_back(pt[i0]);
-
-			bin.gldata.push_back(p2);
-			bin.gldata.push_back(pv[i1]);
-			bin.gldata.push_back(pn[i1]);
-			bin.gldata.push_back(pc[i1]);
-			bin.gldata.push_back(pt[i1]);
-
-			bin.gldata.push_back(p3);
-			bin.gldata.push_back(pv[i2]);
-			bin.gldata.push_back(pn[i2]);
-			bin.gldata.push_back(pc[i2]);
-			bin.gldata.push_back(pt[i2]);
+	Bingltri tri;
+	bool backfacing = false;
+	if (beyond_guardband) {
+		const auto h1 = vpd.clip_to_screen(vp.eye_to_clip(pv[i0]));
+		const auto h2 = vpd.clip_to_screen(vp.eye_to_clip(pv[i1]));
+		const auto h3 = vpd.clip_to_screen(vp.eye_to_clip(pv[i2]));
+		if (!tri.setup.setup_homogeneous(h1, h2, h3, p1, p2, p3)) return; // cull
+	} else {
+		const auto d31 = p3 - p1;
+		const auto d21 = p2 - p1;
+		const float area = d31.x*d21.y - d31.y*d21.x;
+		backfacing = area < 0;
+		if (backfacing) return; // cull
+		/*
+		if (backfacing) {
+			std::swap(p1, p3);
+			std::swap(i0, i2);
 		}
+		*/
+		tri.setup.setup(p1, p2, p3);
+	}
+	triangles++;
+
+	const vec4 pf[3] = { p1, p2, p3 };
+	const int pi[3] = { i0, i1, i2 };
+	for (int i = 0; i < 3; i++) {
+		tri.v[i*5 + 0] = pf[i];
+		tri.v[i*5 + 1] = pv[pi[i]];
+		tri.v[i*5 + 2] = pn[pi[i]];
+		tri.v[i*5 + 3] = pc[pi[i]];
+		tri.v[i*5 + 4] = pt[pi[i]];
+	}
+	tri.facedata = material_id;
+	if (backfacing) tri.facedata |= 0x80;
+	const unsigned id = gltris.push_back(arena, tri);
+
+	auto add = [this, id](Tilebin& bin) {
+		bin.gltris.push_back(arena, id);
+	};
+	if (beyond_guardband) {
+		for_each_bin(tri.setup, add);
+	} else {
+		for_each_bin(p1, p2, p3, add);
 	}
 }
 
 
 
 
-Pipeline::Pipeline(const int threads, class Telemetry& telemetry)
-	:threads(threads), telemetry(telemetry)
+Pipeline::Pipeline(const int threads, const int first_cpu, class Telemetry& telemetry)
+	:threads(threads),
+	cur(0),
+	mode(PIPELINE_LATENCY),
+	kernels(&raster_kernels()),
+	occlusion(false),
+	depth_prepass(false),
+	occluder(nullptr),
+	tile_level(2),
+	tile_votes(0),
+	tile_device_width(0),
+	tile_device_height(0),
+	telemetry(telemetry)
 {
-	for (int i = 0; i < threads; i++) {
-		pipes[i].setup(i, threads);
-		if (i) {
-			workers.push_back(thread(&Pipeline::workerthread, this, i));
-		}
+	binstats = { 0, 0, 0 };
+	fs_set_threads(threads);
+	for (auto& frame : frames) {
+		frame.pipes.resize(threads);
+		frame.pending = false;
+		frame.passes = 1;
+		frame.clear_color_enable = false;
+		frame.hiz_build = false;
 	}
+
+	// each worker binds itself and then places its own pipes, so that
+	// they are allocated on its numa node
+	jobs = make_unique<JobSystem>(threads, [this, first_cpu](const int thread_number) {
+		bind_to_cpu(first_cpu + thread_number);
+		sse_configure();
+		if (perf_enabled()) perf_thread_begin();
+		for (auto& frame : frames) {
+			frame.pipes.place(thread_number);
+			frame.pipes[thread_number].setup(thread_number, this->threads);
+		}
+	});
 }
 
-Pipeline::~Pipeline()
+
+/*
+ * pick the tile size for the frame being set up.
+ *
+ * the coarsest size that gives every worker a few tiles sets the
+ * floor.  from the previous frame's bins, a bin holding more than one
+ * worker's share asks for smaller tiles, and triangles landing in many
+ * bins on average ask for bigger ones.  a new size is only taken after
+ * it has been asked for several frames in a row, except on resize.
+ */
+void Pipeline::choose_tile_size(const int width, const int height)
 {
-	for (int i = 1; i < threads; i++) {
-		pipes[i].my_signal = -1;
+	const int tiles_per_worker = 4;
+	const float max_duplication = 2.0f;
+	const int hysteresis = 8;
+
+	auto tiles_at = [width, height](const int level) {
+		const int tw = tile_sizes[level][0], th = tile_sizes[level][1];
+		return ((width + tw - 1) / tw) * ((height + th - 1) / th);
+	};
+
+	int coarsest = 0;
+	while (coarsest < tile_levels - 1 && tiles_at(coarsest) < threads * tiles_per_worker) {
+		coarsest++;
 	}
-	for (auto & thread : workers) {
-		thread.join();
+
+	const bool resized = width != tile_device_width || height != tile_device_height;
+	if (resized) {
+		tile_device_width = width;
+		tile_device_height = height;
+		tile_level = coarsest;
+		tile_votes = 0;
+	} else {
+		int level = max(tile_level, coarsest);
+		if (binstats.triangles > 0) {
+			const float duplication = float(binstats.entries) / binstats.triangles;
+			const bool long_tail = binstats.heaviest * threads > binstats.entries;
+			if (long_tail && duplication < max_duplication && level < tile_levels - 1) {
+				level++;
+			} else if (duplication > max_duplication && level > coarsest) {
+				level--;
+			}
+		}
+		if (level == tile_level) {
+			tile_votes = 0;
+		} else if (++tile_votes >= hysteresis) {
+			tile_level = level;
+			tile_votes = 0;
+		}
 	}
+
+	tile_width = tile_sizes[tile_level][0];
+	tile_height = tile_sizes[tile_level][1];
+	telemetry.counter("tile_width", tile_width);
+	telemetry.counter("tile_height", tile_height);
 }
 
 
@@ -233,8 +398,7 @@ void Pipedata::setup(const int thread_number, const int thread_count)
 {
 	this->thread_number = thread_number;
 	this->thread_count = thread_count;
-	this->root_count = 0;
-	this->my_signal = 0;
+	queued_count = 0;
 }
 
 
@@ -257,11 +421,18 @@ void Pipedata::addFace(const Viewport& vp, const Viewdevice& vpd, const Face& fs
 	const unsigned required_clipping = pv1_cf | pv2_cf | pv3_cf;
 	if (required_clipping == 0) {
 		// all inside
-		process_face(fsrc.make_rebased(vbase, tbase, nbase), vp, vpd);
+		process_face(fsrc.make_rebased(vbase, tbase, nbase), vp, vpd, false);
+		return;
+	}
+	if (!(required_clipping & CLIP_NEAR)) {
+		// past the guard band but all in front, rasterized as it is
+		process_face(fsrc.make_rebased(vbase, tbase, nbase), vp, vpd, true);
 		return;
 	}
 
-	// 	needs clipping
+	// 	needs clipping, but only against the near plane.  the pieces
+	// still go to the homogeneous rasterizer, which takes the rest.
+	Perfscope clipscope(PERFPHASE_CLIP);
 	unsigned a_vidx[32], b_vidx[32];
 	unsigned a_tidx[32], b_tidx[32];
 	unsigned a_nidx[32], b_nidx[32];
@@ -276,7 +447,7 @@ void Pipedata::addFace(const Viewport& vp, const Viewdevice& vpd, const Face& fs
 	for (int clip_plane = 0; clip_plane < 5; clip_plane++) { // XXX set to 6 to enable the far plane
 
 		const int planebit = 1 << clip_plane;
-		if (!(required_clipping & planebit)) continue; // skip plane that is ok
+		if (!(required_clipping & planebit & CLIP_NEAR)) continue; // skip plane that is ok
 
 		bool we_are_inside;
 		unsigned this_pi = 0;
@@ -343,7 +514,7 @@ void Pipedata::addFace(const Viewport& vp, const Viewdevice& vpd, const Face& fs
 			a_vidx[0], a_vidx[a], a_vidx[a + 1],
 			a_tidx[0], a_tidx[a], a_tidx[a + 1],
 			a_nidx[0], a_nidx[a], a_nidx[a + 1]);
-		process_face(f, vp, vpd);
+		process_face(f, vp, vpd, true);
 	}
 
 }
@@ -385,231 +556,628 @@ __forceinline void Pipedata::addVertex(const Viewport& vp, const vec4& src, cons
 }
 
 
-void Pipedata::process_face(PFace& f, const Viewport& vp, const Viewdevice& vpd)
+void Pipedata::process_face(const PFace& f, const Viewport& vp, const Viewdevice& vpd, const bool beyond_guardband)
 {
-	vec4 p1 = vpd.clip_to_device(vp.eye_to_clip(vlst_p[f.ivp[0]]));
-	vec4 p2 = vpd.clip_to_device(vp.eye_to_clip(vlst_p[f.ivp[1]]));
-	vec4 p3 = vpd.clip_to_device(vp.eye_to_clip(vlst_p[f.ivp[2]]));
+	if (!beyond_guardband) {
+		queued_faces[queued_count++] = f;
+		if (queued_count == 4) setup_faces(vp, vpd);
+		return;
+	}
+
+	// the queue goes first, so that faces are binned, and drawn, in order
+	if (queued_count > 0) setup_faces(vp, vpd);
 
-	const vec4 d31 = p3 - p1;
-	const vec4 d21 = p2 - p1;
-	const float area = d31.x*d21.y - d31.y*d21.x;
+	const vec4 h1 = vpd.clip_to_screen(vp.eye_to_clip(vlst_p[f.ivp[0]]));
+	const vec4 h2 = vpd.clip_to_screen(vp.eye_to_clip(vlst_p[f.ivp[1]]));
+	const vec4 h3 = vpd.clip_to_screen(vp.eye_to_clip(vlst_p[f.ivp[2]]));
 
-	bool backfacing = area < 0;
-	
-	if (backfacing) return; // cull
+	binner.insert_homogeneous(h1, h2, h3, f);
+}
 
-//	if (f.backfacing) {
-//		std::swap(p1, p3);
-//	}
 
-	binner.insert(p1, p2, p3, backfacing, f);
+/*
+ * set up and bin the queued faces.  their vertices go to device space
+ * and through TriSetup::setup() four at a time, in SoA; a short batch
+ * repeats its last face in the lanes left over.
+ */
+void Pipedata::setup_faces(const Viewport& vp, const Viewdevice& vpd)
+{
+	vec4 eye[3][4];
+	for (int t = 0; t < 4; t++) {
+		const PFace& f = queued_faces[min(t, queued_count - 1)];
+		for (int i = 0; i < 3; i++) eye[i][t] = vlst_p[f.ivp[i]];
+	}
+
+	qfloat4 s[3];
+	vec4 p[3][4];
+	for (int i = 0; i < 3; i++) {
+		qfloat4 e, c;
+		xform_load(eye[i], e);
+		xform_mul(vp.mp, e, c);
+		vpd.clip_to_device(c, s[i]);
+		xform_store(s[i], p[i]);
+	}
+
+	Bintri tri[4];
+	TriSetup * const ts[4] = { &tri[0].setup, &tri[1].setup, &tri[2].setup, &tri[3].setup };
+	const int front = triangle_setup4(s, ts);
+	for (int t = 0; t < queued_count; t++) {
+		if (!(front & (1 << t))) continue;
+		tri[t].face = queued_faces[t];
+		binner.insert(tri[t], p[0][t], p[1][t], p[2][t]);
+	}
+	queued_count = 0;
+}
+
+
+// Face::n points towards the eye where the face is front facing
+const float meshlet_facing = 1.0f;
+
+
+/*
+ * can the whole meshlet be skipped?  its sphere is tested against the
+ * frustum in eye space, its normal cone against the eye in object space,
+ * where facing is as it is on screen whatever the instance's scale.  the
+ * cone test is the conservative one: the angle to the sphere's center,
+ * plus the sphere's and the cone's half angles, stay below 90 degrees.
+ */
+__forceinline bool meshlet_visible(const Meshlet& ml, const Viewport& vp, const mat4& to_camera, const float scale, const vec4& eye, const float facing)
+{
+	const vec4 center = mat4_mul(to_camera, vec4(ml.sphere.x, ml.sphere.y, ml.sphere.z, 1.0f));
+	const float radius = ml.sphere.w * scale;
+	for (int fi = 0; fi < 6; fi++) {
+		if (vp.frust[fi].distance(center) < -radius) return false;
+	}
+
+	const vec4 d = vec4(ml.sphere.x, ml.sphere.y, ml.sphere.z, 1.0f) - eye;
+	const vec4 axis(ml.cone.x, ml.cone.y, ml.cone.z, 0);
+	return dot(d, axis) * facing < ml.cone.w * length(d) + ml.sphere.w;
 }
 
 
-void Pipedata::addMeshy(Meshy& mi, const mat4& camera_inverse, const Viewport& vp, const Viewdevice& vpd)
+// cosine of the angle within which faces count as edge on
+const float backface_edge_on = 1.0f / 1024;
+
+static_assert(meshlet_max_vertices <= 64, "a meshlet's points must fit a 64 bit mask");
+
+/*
+ * which of the meshlet's faces the eye sees, tested four at a time in
+ * object space before anything is transformed.  a face is behind when
+ * its normal points away from the eye by more than edge on; faces that
+ * are closer to edge on are left to the exact test on screen.  sets
+ * front[i] for the faces in front, and returns the points they use.
+ */
+__forceinline uint64_t meshlet_front_faces(const Mesh& mesh, const Meshlet& ml, const vec4& eye, const float facing, unsigned char * const __restrict front)
 {
-	const Mesh& mesh = *mi.mesh;
+	const vec4 * const points = mesh.mlvp.data() + ml.vp_begin;
+	const Face * const faces = mesh.mlfaces.data() + ml.face_begin;
+	const int count = ml.face_end - ml.face_begin;
+	const vec4 edge_on(backface_edge_on * backface_edge_on);
+
+	uint64_t used = 0;
+	for (int fi = 0; fi < count; fi += 4) {
+		vec4 n[4], d[4];
+		for (int k = 0; k < 4; k++) {
+			const Face& f = faces[min(fi + k, count - 1)];
+			n[k] = f.n;
+			d[k] = points[f.ivp[0]] - eye;
+		}
+		qfloat4 nq, dq;
+		xform_load(n, nq);
+		xform_load(d, dq);
+		const vec4 nd = (nq.v[0] * dq.v[0] + nq.v[1] * dq.v[1] + nq.v[2] * dq.v[2]) * vec4(facing);
+		const vec4 nn = nq.v[0] * nq.v[0] + nq.v[1] * nq.v[1] + nq.v[2] * nq.v[2];
+		const vec4 dd = dq.v[0] * dq.v[0] + dq.v[1] * dq.v[1] + dq.v[2] * dq.v[2];
+		const int behind = movemask(bits2float(
+			float2bits(cmplt(vec4::zero(), nd)) &
+			float2bits(cmplt(edge_on * nn * dd, nd * nd))));
+
+		for (int k = 0; k < min(4, count - fi); k++) {
+			front[fi + k] = !(behind & (1 << k));
+			if (front[fi + k]) {
+				const Face& f = faces[fi + k];
+				used |= (uint64_t(1) << f.ivp[0]) | (uint64_t(1) << f.ivp[1]) | (uint64_t(1) << f.ivp[2]);
+			}
+		}
+	}
+	return used;
+}
 
-	int next_idx = (thread_number + (root_count++)) % thread_count;
 
-	int this_idx = 0;
-	mat4 item;
-	for (mi.begin(thread_number); mi.next(thread_number, item); this_idx++) {
+/*
+ * transform and bin meshlets [meshlet_begin, meshlet_end) of a run of
+ * instances.  meshlets outside of the frustum or facing away are skipped
+ * before any of their points are transformed, and with an occluder so
+ * are instances and meshlets that it hides.  of the rest, only faces in
+ * front go on to be clipped and binned, and only the points they use
+ * are transformed.
+ */
+void Pipedata::addInstances(const Mesh& mesh, const bool shadows, const MeshInstance * const first, const MeshInstance * const last, const int meshlet_begin, const int meshlet_end, const mat4& camera_inverse, const Viewport& vp, const Viewdevice& vpd, const HiZ * const occluder)
+{
+	// a single meshlet is no smaller than the instance's own bounds
+	const bool cull_meshlets = mesh.meshlets.size() > 1;
 
-		if (this_idx != next_idx) continue;
-		next_idx += thread_count;
+	for (auto inst = first; inst != last; inst++) {
 
 		mat4 to_camera;
-		mat4_mul(camera_inverse, item, to_camera);
+		mat4_mul(camera_inverse, inst->xform, to_camera);
 
-		vec4 tbb[8];
-		for (int bi = 0; bi < 8; bi++ )
-			tbb[bi] = mat4_mul(to_camera, mesh.bbox[bi]);
-		if (!vp.is_visible(tbb)) continue;
+		if (!inst->contained) {
+			vec4 tbb[8];
+			for (int bi = 0; bi < 8; bi++ )
+				tbb[bi] = mat4_mul(to_camera, mesh.bbox[bi]);
+			if (!vp.is_visible(tbb)) continue;
+		}
+		const bool occludable = occluder != nullptr && inst->still;
+		if (occludable && occluder->occluded(inst->xform, mesh.bbox)) continue;
 
-		if ( mi.shadows_enabled() ) {
+		if ( shadows ) {
 			ShadowMesh sm;
-			sm.mesh = mi.mesh;
+			sm.mesh = &mesh;
 			sm.c2o = mat4_inverse(to_camera);
 			sm.vbase = vlst_p.size();
 //			build_shadows(vp, vpd, 0, sm);
 		}
 
-		begin_batch();
-		for (auto& vert : mesh.bvp)
-			addVertex(vp, vert, to_camera);
-		for (auto& uv : mesh.buv)
-			addUV(uv);
-		for (auto& normal : mesh.bpn)
-			addNormal(normal, to_camera);
-
-		Face face;
-		mi.fbegin(thread_number);
-		for (; mi.fnext(thread_number, face); ) {
-			addFace(vp, vpd, face);
+		const vec4 ax(to_camera.v[0]), ay(to_camera.v[1]), az(to_camera.v[2]);
+		const float scale = mat4_max_stretch(to_camera);
+		// a mirroring transform turns the faces around
+		const float facing = dot(cross(ax, ay), az) < 0 ? -meshlet_facing : meshlet_facing;
+		const vec4 eye = mat4_mul(mat4_inverse(to_camera), vec4(0, 0, 0, 1));
+
+		for (int mli = meshlet_begin; mli < meshlet_end; mli++) {
+			const Meshlet& ml = mesh.meshlets[mli];
+			if (cull_meshlets && !meshlet_visible(ml, vp, to_camera, scale, eye, facing)) continue;
+			if (cull_meshlets && occludable && occluder->occluded_sphere(inst->xform, ml.sphere)) continue;
+
+			unsigned char front[meshlet_max_faces];
+			const uint64_t used = meshlet_front_faces(mesh, ml, eye, facing, front);
+			if (used == 0) continue;
+
+			begin_batch();
+			{
+				Perfscope vertexscope(PERFPHASE_VERTEX);
+				vlst_p.resize(vbase + ml.vp_count);
+				vlst_cf.resize(vbase + ml.vp_count);
+				xform_points(to_camera, vp.mp, mesh.mlvp.data() + ml.vp_begin, ml.vp_count, vlst_p.data() + vbase, vlst_cf.data() + vbase, used);
+				new_vcnt += ml.vp_count;
+
+				tlst.insert(tlst.end(), mesh.mluv.begin() + ml.uv_begin, mesh.mluv.begin() + ml.uv_begin + ml.uv_count);
+				new_tcnt += ml.uv_count;
+
+				nlst.resize(nbase + ml.pn_count);
+				xform_vectors(to_camera, mesh.mlpn.data() + ml.pn_begin, ml.pn_count, nlst.data() + nbase);
+				new_ncnt += ml.pn_count;
+			}
+
+			if (inst->material < 0) {
+				for (int fi = ml.face_begin; fi < ml.face_end; fi++)
+					if (front[fi - ml.face_begin]) addFace(vp, vpd, mesh.mlfaces[fi]);
+			} else {
+				Face face;
+				for (int fi = ml.face_begin; fi < ml.face_end; fi++) {
+					if (!front[fi - ml.face_begin]) continue;
+					face = mesh.mlfaces[fi];
+					face.mf = inst->material;
+					addFace(vp, vpd, face);
+				}
+			}
+			end_batch();
 		}
-//		for (auto& face : mesh.faces)
-//			addFace(face);
-		end_batch();
 
 	}
+	if (queued_count > 0) setup_faces(vp, vpd);
 }
 
-void Pipeline::render_thread(const int thread_number)
+/*
+ * rasterize bin idx within rect, which is either the bin's whole tile
+ * or a strip of it
+ */
+void Pipeline::render_bin(PipeFrame& frame, const int idx, const irect& rect, const int thread_number)
 {
-	while (1) {
-		auto binnumber = current_bin++;
-
-		int idx;
-		if (0) {
-			// linear order
-			if (binnumber >= pipes[0].binner.bins.size()) break;
-			idx = binnumber;
-		} else {
-			// use the sort index
-			if (binnumber >= bin_index.size()) break;
-			idx = bin_index[binnumber].first;
-		}
-
-		const irect& tilerect = pipes[0].binner.bins[idx].rect;
-
-		db->clear(tilerect);
-		//cb->clear(tilerect);
-		if (this->clear_color_enable) {
-			cb->clear(tilerect, this->clear_color_rgb);
-		}
-		for (int pass = 0; pass < passes; pass++) {
+	const double t0 = telemetry.now();
+	Perfscope rasterscope(PERFPHASE_RASTER);
+	auto& pipes = frame.pipes;
+	auto& db = frame.db;
+	auto& cb = frame.cb;
+
+	db->clear(rect);
+	//cb->clear(rect);
+	if (frame.clear_color_enable) {
+		cb->clear(rect, frame.clear_color_rgb);
+	}
+	for (int pass = 0; pass < frame.passes; pass++) {
+		// the depths of every thread's triangles go first, then they are shaded in the usual order
+		if (depth_prepass) {
 			for (int ti = 0; ti < threads; ti++) {
-				pipes[ti].render(db->rawptr(), cb->rawptr(), *materialstore, *texturestore, *vpd, idx, pass);
-				pipes[ti].render_gltri(db->rawptr(), cb->rawptr(), *materialstore, *texturestore, *vpd, idx, pass);
-				pipes[ti].render_rect(db->rawptr(), cb->rawptr(), *materialstore, *texturestore, *vpd, idx, pass);
-				//			mark(false);
+				kernels->render_depth(pipes[ti], db->rawptr(), cb->rawptr(), *frame.materialstore, *frame.texturestore, *frame.vpd, idx, rect, pass);
 			}
 		}
-		convertCanvas(tilerect, target_width, target, cb->rawptr(), PostprocessNoop());
-		telemetry.mark(thread_number);
+		const BinKernel render_tris = depth_prepass ? kernels->render_equal : kernels->render;
+		for (int ti = 0; ti < threads; ti++) {
+			render_tris(pipes[ti], db->rawptr(), cb->rawptr(), *frame.materialstore, *frame.texturestore, *frame.vpd, idx, rect, pass);
+			kernels->render_gltri(pipes[ti], db->rawptr(), cb->rawptr(), *frame.materialstore, *frame.texturestore, *frame.vpd, idx, rect, pass);
+			kernels->render_rect(pipes[ti], db->rawptr(), cb->rawptr(), *frame.materialstore, *frame.texturestore, *frame.vpd, idx, rect, pass);
+			//			mark(false);
+		}
+	}
+	if (frame.hiz_build) {
+		frame.hiz.reduce(*frame.db, rect);
 	}
+	const double t1 = telemetry.span(thread_number, TELESTAGE_RASTER, t0, idx);
+	{
+		Perfscope convertscope(PERFPHASE_CONVERT);
+		kernels->convert(rect, frame.target_width, frame.target, cb->rawptr());
+	}
+	telemetry.span(thread_number, TELESTAGE_CONVERT, t1, idx);
 }
 
 
 void Pipeline::addLight(const Light& light)
 {
 	for (int i = 0; i < threads; i++) {
-		this->pipes[i].addLight(camera_inverse, light);
+		frames[cur].pipes[i].addLight(camera_inverse, light);
 	}
 }
 
 
-void Pipeline::process_thread(const int thread_number){
-	auto& pipe = this->pipes[thread_number];
-	for (unsigned i = 0; i < this->meshlist.size(); i++ ) {
-		auto& mesh = this->meshlist[i];
-		auto& vp = *this->viewlist[i];
-		pipe.addMeshy(*mesh, camera_inverse, vp, *vpd);
+/*
+ * walk one Meshy's op chain once and keep its instances that may be in
+ * view.  the op cursors are per thread, so any worker can flatten any
+ * Meshy.  culling goes through a tree of the instances' spheres, so
+ * runs of instances are dropped or accepted in one test; those that
+ * straddle the frustum still get the exact bbox test in addInstances.
+ *
+ * with occlusion culling, instances are compared with the ones of the
+ * frame the occluder was drawn from, in op chain order, and only those
+ * in the same place may be culled.  then this frame's are kept for the
+ * next time its depth is used.
+ */
+void Pipeline::flatten(const int meshy_idx, const int thread_number)
+{
+	const double t0 = telemetry.now();
+	auto& mi = *meshlist[meshy_idx];
+	auto& lst = instances[meshy_idx];
+	lst.clear();
+
+	MeshInstance inst;
+	for (mi.begin(thread_number); mi.next(thread_number, inst.xform); ) {
+		inst.material = mi.material(thread_number);
+		inst.contained = 0;
+		inst.still = 0;
+		lst.push_back(inst);
 	}
-	telemetry.mark(thread_number);
+
+	auto& frame = frames[cur];
+	if (frame.hiz_build) {
+		auto& drawn = frame.hiz_xforms[meshy_idx];
+		if (occluder != nullptr && drawn.size() == lst.size()) {
+			for (size_t i = 0; i < lst.size(); i++) {
+				lst[i].still = memcmp(&lst[i].xform, &drawn[i], sizeof(mat4)) == 0;
+			}
+		}
+		drawn.resize(lst.size());
+		for (size_t i = 0; i < lst.size(); i++) {
+			drawn[i] = lst[i].xform;
+		}
+	}
+
+	auto& tree = instance_trees[meshy_idx];
+	tree.build(lst.data(), lst.size(), mi.mesh->sphere);
+	lst.resize(tree.cull(*viewlist[meshy_idx], camera_inverse, lst.data()));
+	telemetry.span(thread_number, TELESTAGE_GEOMETRY, t0, -1, meshy_idx);
 }
 
-void Pipeline::workerthread(const int thread_number)
-{
-	bind_to_cpu(thread_number);
-	auto& pipe = pipes[thread_number];
-	auto& signal_start = pipe.my_signal;
 
-	bool done = false;
-	while (!done) {
-		while (signal_start == 0) SLEEP_METHOD;
+/*
+ * cut the flattened instances into chunks of roughly equal face count.
+ * there are several chunks per worker so that uneven costs (culling,
+ * clipping) even out, and instances bigger than one chunk are split
+ * into meshlet ranges.
+ */
+void Pipeline::plan_geometry()
+{
+	const int chunks_per_worker = 8;
+	const int chunk_faces_min = 2048;
 
-		int job_to_do = signal_start;
+	size_t total = 0;
+	for (size_t mi = 0; mi < meshlist.size(); mi++) {
+		total += instances[mi].size() * meshlist[mi]->mesh->faces.size();
+	}
+	const int budget = max(chunk_faces_min, int(total / (threads * chunks_per_worker)));
+
+	chunks.clear();
+	for (int mi = 0; mi < int(meshlist.size()); mi++) {
+		const auto& mesh = *meshlist[mi]->mesh;
+		const int faces = mesh.faces.size();
+		const int meshlets = mesh.meshlets.size();
+		const int count = instances[mi].size();
+		if (faces == 0 || count == 0) continue;
+
+		if (faces > budget) {
+			// whole meshlets, about step faces each
+			const int pieces = (faces + budget - 1) / budget;
+			const int step = (faces + pieces - 1) / pieces;
+			for (int ii = 0; ii < count; ii++) {
+				int begin = 0, acc = 0;
+				for (int mli = 0; mli < meshlets; mli++) {
+					acc += mesh.meshlets[mli].face_end - mesh.meshlets[mli].face_begin;
+					if (acc >= step || mli == meshlets - 1) {
+						chunks.push_back({ mi, ii, ii + 1, begin, mli + 1 });
+						begin = mli + 1;
+						acc = 0;
+					}
+				}
+			}
+		} else {
+			const int per = budget / faces;
+			for (int ii = 0; ii < count; ii += per) {
+				chunks.push_back({ mi, ii, min(ii + per, count), 0, meshlets });
+			}
+		}
+	}
+	chunk_cursor = 0;
+}
 
-		sse_configure();
 
-		if (job_to_do == -1) {
-			done = true;
-		} else if (job_to_do == 1) {
-			process_thread(thread_number);
-		} else if (job_to_do == 2) {
-			render_thread(thread_number);
+/*
+ * claim chunks until there are none left.  output goes to the pipe of
+ * the worker running the job, so a pipe is never shared.
+ *
+ * a worker may run several of the geometry jobs, or none, so the
+ * procedurals are handed the job's slice instead of the worker's number.
+ */
+void Pipeline::process_thread(const int slice, const int thread_number){
+	// a scope per face or batch would cost more than the work it counts
+	Perfscope binscope(PERFPHASE_BIN);
+	double t0 = telemetry.now();
+	auto& frame = frames[cur];
+	auto& pipe = frame.pipes[thread_number];
+	const int chunk_count = chunks.size();
+	while (1) {
+		const int ci = chunk_cursor++;
+		if (ci >= chunk_count) break;
+
+		const auto& chunk = chunks[ci];
+		auto& mi = *meshlist[chunk.meshy];
+		const auto * const lst = instances[chunk.meshy].data();
+		pipe.addInstances(*mi.mesh, mi.shadows_enabled(), lst + chunk.first, lst + chunk.last, chunk.meshlet_begin, chunk.meshlet_end, camera_inverse, *viewlist[chunk.meshy], *frame.vpd, occluder);
+		t0 = telemetry.span(thread_number, TELESTAGE_GEOMETRY, t0, -1, chunk.meshy);
+	}
+	if (!procedurals.empty()) {
+		for (auto& fn : procedurals) {
+			fn(pipe, slice, threads);
 		}
-		signal_start = 0;
+		telemetry.span(thread_number, TELESTAGE_GEOMETRY, t0);
 	}
 }
 
-#define START_WORKERS(a) for (int _i=1; _i<this->threads; _i++) pipes[_i].my_signal = (a)
-#define JOIN_WORKERS for(int _i=1; _i<this->threads; _i++) while(pipes[_i].my_signal!=0) SLEEP_METHOD
 
-void Pipeline::render()
+/*
+ * deal the bins out light-to-heavy, so that every worker pops its
+ * heaviest bin first and thieves pick up the light ones.
+ *
+ * a bin costing more than a fair share of the frame would decide the
+ * length of the raster phase on its own, so it is cut into horizontal
+ * strips that are rasterized as separate jobs against the same bin
+ * contents.  strips keep the full tile width and start on multiples of
+ * 8 rows, to stay aligned to the 2x2 quads and to the HiZ blocks.
+ *
+ * when the frame's depth is wanted for occlusion culling, one more job
+ * waits for all of the bins and finishes the pyramid.
+ */
+void Pipeline::spawn_raster(PipeFrame& frame)
 {
-	START_WORKERS(1); process_thread(0); JOIN_WORKERS;
-	telemetry.inc();
-
-	index_bins();
-	telemetry.mark(0);
-	telemetry.inc();
+	const int split_min_cost = 256;
+	const int strip_min_height = 8;
 
-	current_bin = 0;
-	START_WORKERS(2); render_thread(0); JOIN_WORKERS;
-	telemetry.inc();
-}
+	const auto& bin_index = frame.bin_index;
+	const auto& bins = frame.pipes[0].binner.bins;
 
+	int total = 0;
+	for (const auto& item : bin_index) {
+		total += item.second;
+	}
+	const int share = max(split_min_cost, total / (threads * 2));
+
+	Job * hiz = nullptr;
+	frame.hiz.ready = false;
+	if (frame.hiz_build) {
+		frame.hiz.setup(frame.db->width, frame.db->height);
+		frame.hiz.world_to_screen = frame.hiz_view;
+		frame.hiz.eye = frame.hiz_eye;
+		hiz = jobs->create([&frame](const int) {
+			frame.hiz.build();
+			frame.hiz.ready = true;
+		});
+	}
 
+	int ti = 0;
+	for (int bi = int(bin_index.size()) - 1; bi >= 0; bi--) {
+		const int idx = bin_index[bi].first;
+		const irect& tilerect = bins[idx].rect;
+		const int height = tilerect.y1 - tilerect.y0;
+		const int pieces = min(bin_index[bi].second / share, height / strip_min_height);
+
+		if (pieces <= 1) {
+			Job * const job = jobs->create([this, &frame, idx, tilerect](const int thread_number) {
+				render_bin(frame, idx, tilerect, thread_number);
+			});
+			if (hiz) jobs->depends(hiz, job);
+			jobs->submit(job, ti++);
+			continue;
+		}
 
-void Pipedata::render(__m128 * __restrict db, SOAPixel * __restrict cb, MaterialStore& materialstore, TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const int pass)
-{
-	FlatShader my_shader;
-	my_shader.setColorBuffer(cb);
-	my_shader.setDepthBuffer(db);
-	my_shader.setColor(vec4(1, 0.66, 0.33, 0));
+		const int step = ((height + pieces - 1) / pieces + 7) & ~7;
+		for (int y = tilerect.y0; y < tilerect.y1; y += step) {
+			const irect strip(y, min(y + step, tilerect.y1), tilerect.x0, tilerect.x1);
+			Job * const job = jobs->create([this, &frame, idx, strip](const int thread_number) {
+				render_bin(frame, idx, strip, thread_number);
+			});
+			if (hiz) jobs->depends(hiz, job);
+			jobs->submit(job, ti++);
+		}
+	}
+	if (hiz) jobs->submit(hiz, 0);
+	frame.pending = false;
+}
 
-	WireShader wire_shader;
-	wire_shader.setColorBuffer(cb);
-	wire_shader.setDepthBuffer(db);
-	wire_shader.setColor(vec4(1, 0.66, 0.33, 0));
 
-	auto& bin = binner.bins[bin_idx];
+/*
+ * choose the depth that this frame's instances are tested against, and
+ * have this frame's own depth reduced for the ones after it.  the depth
+ * is from the last time frame was rasterized, which in throughput mode
+ * is two frames back, as the other one is being rasterized meanwhile.
+ *
+ * bounds are compared with the depth in the view it was drawn with,
+ * which says the same about the current view only if the eye is where
+ * it was then: turning and zooming are fine, moving is not.
+ */
+void Pipeline::prepare_occlusion(PipeFrame& frame)
+{
+	const float eye_tolerance = 1e-4f;
 
-	unsigned fi = 0;
-	unsigned vi = 0;
-	while (fi < bin.faces.size()) {
+	occluder = nullptr;
+	frame.hiz_build = false;
+	if (!occlusion || viewlist.empty()) return;
 
-		const auto& face = bin.faces[fi];
-		const auto& backfacing = bin.backfacing[fi];
-		const auto& v0_f = bin.vf[vi];
-		const auto& v1_f = bin.vf[vi + 1];
-		const auto& v2_f = bin.vf[vi + 2];
-		fi++;
-		vi += 3;
+	// the depth buffer holds one projection's depths
+	const Viewport& vp = *viewlist[0];
+	for (const auto * const other : viewlist) {
+		if (memcmp(&other->mp, &vp.mp, sizeof(mat4)) != 0) return;
+	}
 
-		if (backfacing) continue;
+	// world to eye, to clip, to screen, a column at a time
+	const Viewdevice& vpd = *frame.vpd;
+	vec4 col[4];
+	for (int ci = 0; ci < 4; ci++) {
+		col[ci] = vpd.clip_to_screen(vp.eye_to_clip(vec4(camera_inverse.v[ci])));
+	}
+	frame.hiz_view = mat4(col[0].v, col[1].v, col[2].v, col[3].v);
+	frame.hiz_eye = mat4_mul(camera, vec4(0, 0, 0, 1));
+	frame.hiz_build = true;
+
+	const HiZ& hiz = frame.hiz;
+	if (hiz.ready && hiz.width == vpd.width && hiz.height == vpd.height &&
+		length(frame.hiz_eye - hiz.eye) <= eye_tolerance) {
+		occluder = &hiz;
+	}
+}
 
-		Material& mat = materialstore.store[face.mf];
-		if (mat.pass != pass) continue;
 
-		if (mat.imagename != string("")) {
-			const auto tex = texturestore.find(mat.imagename);
-			const auto texunit = ts_pow2_mipmap<9>(&tex->b[0]);
-			auto tex_shader = TextureShader<ts_pow2_mipmap<9>>(texunit);
-			tex_shader.setColorBuffer(cb);
-			tex_shader.setDepthBuffer(db);
-			tex_shader.setUV(tlst[face.iuv[0]], tlst[face.iuv[1]], tlst[face.iuv[2]]);
-			tex_shader.setup(vpd.width, vpd.height, v0_f, v1_f, v2_f);
-			draw_triangle(bin.rect, v0_f, v1_f, v2_f, tex_shader);
+/*
+ * one flatten job per Meshy, a planning job that cuts the instances
+ * into chunks, one geometry job per worker draining the chunks, then
+ * one raster job per bin.
+ *
+ * the bins can only be sorted once every pipe is done binning, so the
+ * indexing job depends on all geometry jobs.  workers that finish their
+ * geometry early go on to steal bins instead of waiting at a barrier.
+ *
+ * in latency mode the indexing job spawns this frame's raster jobs.
+ * in throughput mode the previous frame's bins are rasterized while
+ * this frame's geometry runs, and this frame is left pending.
+ */
+void Pipeline::render()
+{
+	jobs->reset();
+
+	auto& frame = frames[cur];
+	auto& previous = frames[cur ^ 1];
+	const bool overlap = mode == PIPELINE_THROUGHPUT;
+
+	prepare_occlusion(frame);
+
+	Job * const binning = jobs->create([this, &frame, overlap](const int thread_number) {
+		telemetry.inc();
+		const double t0 = telemetry.now();
+		index_bins(frame);
+		size_t used = 0, peak = 0, reserved = 0;
+		for (int ti = 0; ti < threads; ti++) {
+			const auto& arena = frame.pipes[ti].binner.arena;
+			used += arena.used();
+			peak += arena.peak();
+			reserved += arena.reserved();
 		}
-		else {
-			if (1) {
-				my_shader.setColor(vec4(mat.kd.x, mat.kd.y, mat.kd.z, 0));
-				my_shader.setup(vpd.width, vpd.height, v0_f, v1_f, v2_f);
-				draw_triangle(bin.rect, v0_f, v1_f, v2_f, my_shader);
-			}
-			else {
-				wire_shader.setColor(vec4(mat.kd.x, mat.kd.y, mat.kd.z, 0));
-				wire_shader.setup(vpd.width, vpd.height, v0_f, v1_f, v2_f);
-				draw_triangle(bin.rect, v0_f, v1_f, v2_f, wire_shader);
-			}
+		telemetry.counter("bin_kb", used / 1024.0);
+		telemetry.counter("bin_peak_kb", peak / 1024.0);
+		telemetry.counter("bin_reserved_kb", reserved / 1024.0);
+		telemetry.span(thread_number, TELESTAGE_INDEX_BINS, t0);
+		telemetry.inc();
+		if (overlap) {
+			frame.pending = true;
+		} else {
+			spawn_raster(frame);
+		}
+	});
+
+	Job * const planning = jobs->create([this](const int thread_number) {
+		const double t0 = telemetry.now();
+		plan_geometry();
+		size_t visible = 0;
+		for (size_t mi = 0; mi < meshlist.size(); mi++) {
+			visible += instances[mi].size();
 		}
+		telemetry.counter("instances", double(visible));
+		telemetry.span(thread_number, TELESTAGE_GEOMETRY, t0);
+	});
+
+	vector<Job*> geometry;
+	for (int i = 0; i < threads; i++) {
+		geometry.push_back(jobs->create([this, i](const int thread_number) {
+			process_thread(i, thread_number);
+		}));
+		jobs->depends(geometry[i], planning);
+		jobs->depends(binning, geometry[i]);
+	}
+
+	if (instances.size() < meshlist.size()) {
+		instances.resize(meshlist.size());
+		instance_trees.resize(meshlist.size());
+	}
+	if (frame.hiz_xforms.size() < meshlist.size()) {
+		frame.hiz_xforms.resize(meshlist.size());
+	}
+	vector<Job*> flattening;
+	for (int mi = 0; mi < int(meshlist.size()); mi++) {
+		flattening.push_back(jobs->create([this, mi](const int thread_number) {
+			flatten(mi, thread_number);
+		}));
+		jobs->depends(planning, flattening[mi]);
+	}
+
+	if (previous.pending) {
+		spawn_raster(previous);
+	}
+	jobs->submit(binning, 0);
+	for (int i = 0; i < threads; i++) {
+		jobs->submit(geometry[i], i);
+	}
+	jobs->submit(planning, 0);
+	for (int mi = 0; mi < int(meshlist.size()); mi++) {
+		jobs->submit(flattening[mi], mi);
+	}
+	jobs->wait(0);
+	telemetry.inc();
+
+	if (overlap) {
+		cur ^= 1;
+	}
+}
+
+
+/*
+ * rasterize the frame left pending by throughput mode, e.g. after the
+ * last frame of a sequence or before the render targets are resized.
+ */
+void Pipeline::flush()
+{
+	auto& previous = frames[cur ^ 1];
+	if (!previous.pending) return;
 
-	}//faces
+	jobs->reset();
+	spawn_raster(previous);
+	jobs->wait(0);
 }
 
 
@@ -775,13 +1343,18 @@ void Pipedata::process_gltri(const Viewport& vp, const Viewdevice& vpd, const in
 	const unsigned required_clipping = cf[0] | cf[1] | cf[2];
 	if (required_clipping == 0) {
 		// all inside
-		binner.insert_gltri(vp, vpd, tri_eye, tri_nor, tri_col, tri_tex, 0, 1, 2, material_id);
+		binner.insert_gltri(vp, vpd, tri_eye, tri_nor, tri_col, tri_tex, 0, 1, 2, material_id, false);
+		return;
+	}
+	if (!(required_clipping & CLIP_NEAR)) {
+		// as in addFace(), only the near plane is clipped
+		binner.insert_gltri(vp, vpd, tri_eye, tri_nor, tri_col, tri_tex, 0, 1, 2, material_id, true);
 		return;
 	}
 
 	for (int clip_plane=0; clip_plane<5; clip_plane++) {
 		const int planebit = 1 << clip_plane;
-		if (!(required_clipping & planebit)) continue;
+		if (!(required_clipping & planebit & CLIP_NEAR)) continue;
 
 		bool we_are_inside;
 		unsigned this_pi = 0;
@@ -845,130 +1418,6 @@ void Pipedata::process_gltri(const Viewport& vp, const Viewdevice& vpd, const in
 	if (pvcnt == 0) return;
 
 	for (int a=1; a<pvcnt-1; a++) {
-		binner.insert_gltri(vp, vpd, tri_eye, tri_nor, tri_col, tri_tex, 0, a, a+1, material_id);
+		binner.insert_gltri(vp, vpd, tri_eye, tri_nor, tri_col, tri_tex, 0, a, a+1, material_id, true);
 	}
 }
-
-#pragma pack(1)
-struct VertexData {
-	vec4 f;
-	vec4 p;
-	vec4 n;
-	vec4 c;
-	vec4 t;
-};
-#pragma pack()
-
-void Pipedata::render_gltri(__m128 * __restrict db, SOAPixel * __restrict cb, MaterialStore& materialstore, TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const int pass)
-{
-	ShadedShader my_shader;
-	my_shader.setColorBuffer(cb);
-	my_shader.setDepthBuffer(db);
-	//	my_shader.setColor(vec4(1, 0.66, 0.33, 0));
-
-	WireShader wire_shader;
-	wire_shader.setColorBuffer(cb);
-	wire_shader.setDepthBuffer(db);
-	wire_shader.setColor(vec4(1, 0.66, 0.33, 0));
-
-	auto& bin = binner.bins[bin_idx];
-
-	unsigned di = 0;
-	unsigned fi = 0;
-	while (di < bin.gldata.size()) {
-
-		auto facedata = bin.glface[fi];
-		bool backfacing = (facedata & 0x80) > 0;
-		int material_id = facedata & 0x7f;
-
-		const auto& v0 = *reinterpret_cast<VertexData*>(&bin.gldata[di + 0]);
-		const auto& v1 = *reinterpret_cast<VertexData*>(&bin.gldata[di + 5]);
-		const auto& v2 = *reinterpret_cast<VertexData*>(&bin.gldata[di + 10]);
-		di += 15; fi++;
-
-		if (backfacing) continue;
-
-		Material& mat = materialstore.store[material_id];
-		if (mat.pass != pass) continue;
-
-		if (mat.imagename != string("")) {
-			const auto tex = texturestore.find(mat.imagename);
-			if (tex->width == 256) {
-				const auto texunit = ts_pow2_direct_nearest<8>(&tex->b[0]);
-				auto tex_shader = TextureShaderAlphaNoZ<ts_pow2_direct_nearest<8>>(texunit);
-				tex_shader.setColorBuffer(cb);
-				tex_shader.setDepthBuffer(db);
-				tex_shader.setUV(v0.t, v1.t, v2.t);
-				tex_shader.setup(vpd.width, vpd.height, v0.f, v1.f, v2.f);
-				draw_triangle(bin.rect, v0.f, v1.f, v2.f, tex_shader);
-			}
-			else if (tex->width == 512) {
-				const auto texunit = ts_pow2_mipmap<9>(&tex->b[0]);
-				auto tex_shader = TextureShader<ts_pow2_mipmap<9>>(texunit);
-				tex_shader.setColorBuffer(cb);
-				tex_shader.setDepthBuffer(db);
-				tex_shader.setUV(v0.t, v1.t, v2.t);
-				tex_shader.setup(vpd.width, vpd.height, v0.f, v1.f, v2.f);
-				draw_triangle(bin.rect, v0.f, v1.f, v2.f, tex_shader);
-			}
-		}
-		else {
-			if (0) {
-				//				my_shader.setColor(vec4(mat.kd.x, mat.kd.y, mat.kd.z, 0));
-				my_shader.setColor(v0.c, v1.c, v2.c);
-				my_shader.setup(vpd.width, vpd.height, v0.f, v1.f, v2.f);
-				draw_triangle(bin.rect, v0.f, v1.f, v2.f, my_shader);
-			}
-			else {
-				wire_shader.setColor(vec4(mat.kd.x, mat.kd.y, mat.kd.z, 0));
-				wire_shader.setup(vpd.width, vpd.height, v0.f, v1.f, v2.f);
-				draw_triangle(bin.rect, v0.f, v1.f, v2.f, wire_shader);
-			}
-		}
-
-	}// gldata
-}
-
-
-void Pipedata::render_rect(__m128 * __restrict db, SOAPixel * __restrict cb, MaterialStore& materialstore, TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const int pass)
-{
-	auto& bin = binner.bins[bin_idx];
-	const irect& tilerect = bin.rect;
-	unsigned di = 0;
-	unsigned fi = 0;
-	while (di < this->rectbyte.size()) {
-
-		int rtype = this->rectbyte[di++];
-		int rvals = this->rectbyte[di++];
-
-		if (rtype == 1) {
-			if (pass != 0) continue;
-			const auto tex = texturestore.find("girl256.png");
-			const auto texunit = ts_any_direct_nearest(&tex->b[0], tex->width, tex->height);
-			DistortShader<ts_any_direct_nearest> the_shader(texunit);
-			//const auto texunit = ts_pow2_direct_nearest<8>(&tex->b[0]);
-			//DistortShader<ts_pow2_direct_nearest<8>> the_shader(texunit);
-			the_shader.setColorBuffer(cb);
-			the_shader.setup(vpd.width, vpd.height);
-			for (int pi=0; pi<rvals; pi++) {
-				const float val = this->rectdata[fi++];
-				the_shader.setParam(pi, val);
-			}
-			draw_rectangle(tilerect, the_shader);
-		} else if (rtype == 2) {
-			if (pass != 0) continue;
-			const auto tex = texturestore.find("water-girl.png");
-			const auto texunit = ts_any_direct_nearest(&tex->b[0], tex->width, tex->height);
-			OverlayShader<ts_any_direct_nearest> the_shader(texunit);
-			the_shader.setColorBuffer(cb);
-			the_shader.setup(vpd.width, vpd.height, tex->width, tex->height);
-			for (int pi=0; pi<rvals; pi++) {
-				const float val = this->rectdata[fi++];
-				the_shader.setParam(pi, val);
-			}
-			draw_rectangle(tilerect, the_shader);
-		}
-
-	}//rectbytes
-}
-
@@ -6,46 +6,69 @@
 
 #include <functional>
 #include <atomic>
-#include <thread>
 #include <vector>
 
 #include "aligned_allocator.h"
 
 #include "vec.h"
+#include "binarena.h"
+#include "tri.h"
 #include "clip.h"
+#include "jobs.h"
+#include "perthread.h"
 #include "mesh.h"
 #include "canvas.h"
 #include "meshops.h"
 #include "viewport.h"
+#include "insttree.h"
+#include "hiz.h"
+#include "kernels.h"
+
+
+/*
+ * a triangle as binned: its raster setup and the face it came from.
+ * stored once per thread in Binner::tris, bins refer to it by index.
+ */
+struct __declspec(align(16)) Bintri {
+	TriSetup setup;
+	PFace face;
+};
 
+/*
+ * a glVertex triangle as binned: its raster setup, per vertex its
+ * device position, eye position, normal, color and uv, then the
+ * material id with bit 7 set for back-facing
+ */
+struct __declspec(align(16)) Bingltri {
+	TriSetup setup;
+	vec4 v[15];
+	unsigned char facedata;
+};
 
+/*
+ * a tile's entries, in chunks from its Binner's arena
+ */
 struct Tilebin {
 	irect rect;
 	int id;
-	vectorsse<vec4> vf;
-	vectorsse<char> backfacing;
-	vectorsse<PFace> faces;
-	vectorsse<vec4> sv;
+	Binlist<unsigned> tris;     // into Binner::tris
+	Binlist<vec4> sv;
 
 	// glVertex api
-	vectorsse<vec4> gldata;
-	std::vector<unsigned char> glface;
+	Binlist<unsigned> gltris;   // into Binner::gltris
 
 	void clear() {
-		vf.clear();
-		backfacing.clear();
-		faces.clear();
+		tris.clear();
 		sv.clear();
-
-		glface.clear();
-		gldata.clear();
+		gltris.clear();
 	}
 };
 
 class Binner {
 public:
-	void reset(const int cur_width, const int cur_height);
-	void insert(const vec4& p1, const vec4& p2, const vec4& p3, const bool backfacing, const PFace& face);
+	void reset(const int cur_width, const int cur_height, const int tile_width, const int tile_height);
+	void insert(const Bintri& tri, const vec4& p1, const vec4& p2, const vec4& p3);
+	void insert_homogeneous(const vec4& h1, const vec4& h2, const vec4& h3, const PFace& face);
 	void insert_shadow(const vec4& p1, const vec4& p2, const vec4& p3);
 	void insert_gltri(
 		const Viewport& vp,
@@ -55,14 +78,23 @@ public:
 		const vec4 * const pc,
 		const vec4 * const pt,
 		int i0, int i1, int i2,
-		const int material_id);
+		const int material_id,
+		const bool beyond_guardband);
 	void sort();
 	void unsort();
-	Binner() :device_height(0), device_width(0) {}
+	Binner() :triangles(0), device_width(0), device_height(0), tilewidth(0), tileheight(0) {}
 	std::vector<irect> binrects;
 	std::vector<Tilebin> bins;
+	int triangles;   // inserted since reset(), before duplication into bins
+
+	Binarena arena;   // the bins' chunks and the triangles below
+	Binstore<Bintri, 6> tris;
+	Binstore<Bingltri, 4> gltris;
 private:
 	void onResize();
+	template <typename FN> void for_each_bin(const vec4& p1, const vec4& p2, const vec4& p3, FN fn);
+	template <typename FN> void for_each_bin(const TriSetup& ts, FN fn);
+	template <typename FN> void for_each_bin(const vec4& bmin, const vec4& bmax, const vec4& ex, const vec4& ey, const vec4& ea, const vec4& eb, const vec4& ec, FN fn);
 	int device_width;
 	int device_height;
 	int tilewidth;
@@ -74,22 +106,56 @@ private:
 
 
 
+/*
+ * one instance of a Meshy, flattened out of its op chain
+ */
+struct __declspec(align(16)) MeshInstance {
+	mat4 xform;
+	int material;   // from Meshy::material(), -1 keeps the mesh's own
+	int contained;  // wholly inside the frustum, per InstanceTree::cull()
+	int still;      // placed as when the occluder's depth was drawn, see Pipeline::flatten()
+};
+
+
+/*
+ * a unit of geometry work: a run of instances of one Meshy, or a meshlet
+ * range of a single instance that is too big to go in one piece
+ */
+struct GeometryChunk {
+	int meshy;
+	int first, last;            // instances
+	int meshlet_begin, meshlet_end;   // meshlets of each instance
+};
+
+
+/*
+ * how Pipedata::render() treats depth.  with a prepass, the opaque
+ * triangles of a bin are drawn DEPTH_ONLY first and then DEPTH_EQUAL,
+ * see Pipeline::setDepthPrepass().
+ */
+enum DepthPass {
+	DEPTH_TEST,     // test, shade and write, the usual
+	DEPTH_ONLY,     // test and write depth, no shading
+	DEPTH_EQUAL,    // shade only what has the depth already written
+};
+
+
 class Pipedata {
 public:
 	void setup(const int thread_number, const int thread_count);
 
-	void addMeshy(Meshy& mi, const mat4& camera_inverse, const Viewport& vp, const Viewdevice& vpd);
+	void addInstances(const Mesh& mesh, const bool shadows, const MeshInstance * const first, const MeshInstance * const last, const int meshlet_begin, const int meshlet_end, const mat4& camera_inverse, const Viewport& vp, const Viewdevice& vpd, const HiZ * const occluder);
 	void add_shadow_triangle(const Viewport& vp, const Viewdevice& vpd, const vec4& p1, const vec4& p2, const vec4& p3);
 	void build_shadows(const Viewport& vp, const Viewdevice& vpd, const int light_id, const struct ShadowMesh& svmesh);
 
-	void reset(const int width, const int height) {
+	void reset(const int width, const int height, const int tile_width, const int tile_height) {
 		vlst_p.clear(); vlst_cf.clear();
 		tlst.clear();
 		nlst.clear();
 		llst.clear();
 		batch_in_progress = 0;
-		root_count = 0;
-		binner.reset(width, height);
+		queued_count = 0;
+		binner.reset(width, height, tile_width, tile_height);
 		rectdata.clear();
 		rectbyte.clear();
 
@@ -100,13 +166,14 @@ public:
 	void addUV(const vec4& src);
 	void addLight(const mat4& camera_inverse, const Light& light);
 	Binner binner;
-	void render(__m128 * __restrict db, SOAPixel * __restrict cb, class MaterialStore& materialstore, class TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const int pass);
-	void render_gltri(__m128 * __restrict db, SOAPixel * __restrict cb, class MaterialStore& materialstore, class TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const int pass);
-	void render_rect(__m128 * __restrict db, SOAPixel * __restrict cb, class MaterialStore& materialstore, class TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const int pass);
+
+	// one of each per KernelTarget, in kernels_impl.h, called through RasterKernels
+	template <int TARGET> void render(__m128 * __restrict db, SOAPixel * __restrict cb, class MaterialStore& materialstore, class TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const irect& rect, const int pass, const DepthPass depth);
+	template <int TARGET> void render_gltri(__m128 * __restrict db, SOAPixel * __restrict cb, class MaterialStore& materialstore, class TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const irect& rect, const int pass);
+	template <int TARGET> void render_rect(__m128 * __restrict db, SOAPixel * __restrict cb, class MaterialStore& materialstore, class TextureStore& texturestore, const Viewdevice& vpd, const int bin_idx, const irect& rect, const int pass);
 
 	void addVertex(const Viewport& vp, const vec4& src, const mat4& m);
 
-	std::atomic<int> my_signal;
 private:
 	void begin_batch() {
 		_ASSERT(batch_in_progress == 0);
@@ -124,7 +191,12 @@ private:
 		nbase = nlst.size();
 		batch_in_progress = 0;
 	}
-	void process_face(PFace& f, const Viewport& vp, const Viewdevice& vpd);
+	void process_face(const PFace& f, const Viewport& vp, const Viewdevice& vpd, const bool beyond_guardband);
+	void setup_faces(const Viewport& vp, const Viewdevice& vpd);
+
+	// faces inside the guard band wait here to be set up four at a time
+	PFace queued_faces[4];
+	int queued_count;
 
 	// indexed buffers api
 	vectorsse<vec4> vlst_p;
@@ -137,7 +209,6 @@ private:
 	int batch_in_progress;
 	int thread_number;
 	int thread_count;
-	int root_count;
 
 
 	// rect-shader api
@@ -245,25 +316,77 @@ private:
 typedef std::pair<int, int> binstat;
 
 
+/*
+ * everything the raster phase of one frame reads.  the pipeline keeps
+ * two of these, so that in throughput mode the next frame can be
+ * transformed and binned while this one is still being rasterized.
+ */
+struct PipeFrame {
+	WorkerLocal<Pipedata> pipes;
+	std::vector<binstat> bin_index;
+	bool pending; // binned, not yet rasterized
+
+	const Viewdevice * vpd;
+	struct SOADepth * db;
+	struct SOACanvas * cb;
+	class MaterialStore * materialstore;
+	int passes;
+	class TextureStore * texturestore;
+	TrueColorPixel * __restrict target;
+	int target_width;
+
+	bool clear_color_enable;
+	vec4 clear_color_rgb;
+
+	// occlusion culling, see Pipeline::setOcclusion()
+	bool hiz_build;       // reduce the depth into hiz while rasterizing
+	mat4 hiz_view;        // world to screen of this frame
+	vec4 hiz_eye;         // camera position of this frame
+	std::vector<vectorsse<mat4>> hiz_xforms;   // per meshlist entry, all instances of this frame
+	HiZ hiz;              // from the last time this frame was rasterized
+};
+
+
+enum PipelineMode {
+	PIPELINE_LATENCY,    // render() returns with this frame in the target
+	PIPELINE_THROUGHPUT, // render() bins this frame and rasterizes the previous one
+};
+
+
 class Pipeline {
 public:
-	Pipeline(const int threads, class Telemetry& telemetry);
-	~Pipeline();
+	/*
+	 * workers are bound to cpus first_cpu .. first_cpu+threads-1, so
+	 * that several pipelines can share a machine without overlapping
+	 */
+	Pipeline(const int threads, const int first_cpu, class Telemetry& telemetry);
 
 	void addMeshy(Meshy& mi, const Viewport * vp) {
 		meshlist.push_back(&mi);
 		viewlist.push_back(vp);
 	}
 
+	/*
+	 * procedural geometry such as IsoCubes.  fn runs once per geometry
+	 * job with (pipe, slice, threads), slice going 0..threads-1, and
+	 * picks its own share of the work by slice.
+	 */
+	void addProcedural(std::function<void(Pipedata&, const int, const int)> fn) {
+		procedurals.push_back(fn);
+	}
+
 	void addLight(const Light& li);
 //XXX	void setViewport(const Viewport * const vp) { this->vp = vp; }
-	void setViewdevice(const Viewdevice * const vpd) { this->vpd = vpd; }
+	void setViewdevice(const Viewdevice * const vpd) { frames[cur].vpd = vpd; }
 
 	void reset(const int width, const int height) {
-		for (auto& item : pipes) {
-			item.reset(width, height);
+		choose_tile_size(width, height);
+		auto& pipes = frames[cur].pipes;
+		for (int i = 0; i < threads; i++) {
+			pipes[i].reset(width, height, tile_width, tile_height);
 		}
 		meshlist.clear();  viewlist.clear();
+		procedurals.clear();
 		framecounter++;
 	}
 
@@ -272,80 +395,148 @@ public:
 		camera_inverse = mat4_inverse(camera);
 	}
 	void render();
-	void render_thread(const int thread_number);
-	void process_thread(const int thread_number);
+	void flush();
+	void render_bin(PipeFrame& frame, const int bin_idx, const irect& rect, const int thread_number);
+	void flatten(const int meshy_idx, const int thread_number);
+	void plan_geometry();
+	void process_thread(const int slice, const int thread_number);
+
+	/*
+	 * in throughput mode the target passed to setTarget() is written
+	 * during the *next* call to render() or flush(), so it has to stay
+	 * valid until then.
+	 */
+	void setMode(const PipelineMode mode) {
+		if (mode != this->mode) flush();
+		this->mode = mode;
+	}
+
+	/*
+	 * skip instances and meshlets that were hidden in the last frame
+	 * rasterized.  it holds for as long as the eye does not move, and
+	 * every Meshy is seen through the same projection; otherwise the
+	 * frame is drawn without.  only instances that are where they were
+	 * then are tested, as an animated one would be tested against its
+	 * own old pixels.  an object that an occluder moved away from shows
+	 * up a frame late, so this is for scenes where that is acceptable.
+	 */
+	void setOcclusion(const bool enable) {
+		occlusion = enable;
+	}
+
+	/*
+	 * rasterize with these kernels instead of the best ones for this
+	 * cpu, which the pipeline starts with.  they must run here, see
+	 * find_kernels().
+	 */
+	void setKernels(const RasterKernels& kernels) {
+		this->kernels = &kernels;
+	}
+	const RasterKernels& getKernels() const {
+		return *kernels;
+	}
+
+	/*
+	 * lay down the depth of each bin's opaque triangles before shading
+	 * them, so that a pixel is shaded once however often it is covered.
+	 * the image is the same; it pays when overdraw is high and the
+	 * shading costs more than going over the triangles a second time.
+	 */
+	void setDepthPrepass(const bool enable) {
+		depth_prepass = enable;
+	}
 
-	void index_bins() {
+	void index_bins(PipeFrame& frame) {
+		auto& bin_index = frame.bin_index;
+		const auto& pipes = frame.pipes;
 		bin_index.clear();
+		binstats = { 0, 0, 0 };
 		for (size_t bi = 0; bi < pipes[0].binner.bins.size(); bi++) {
 			int ax = 0; 
 			for (int ti = 0; ti < threads; ti++) {
-				ax += pipes[ti].binner.bins[bi].faces.size();
-				ax += pipes[ti].binner.bins[bi].glface.size();
+				ax += pipes[ti].binner.bins[bi].tris.size();
+				ax += pipes[ti].binner.bins[bi].gltris.size();
 			}
 			bin_index.push_back(binstat(bi, ax));
+			binstats.entries += ax;
+			binstats.heaviest = std::max(binstats.heaviest, ax);
+		}
+		for (int ti = 0; ti < threads; ti++) {
+			binstats.triangles += pipes[ti].binner.triangles;
 		}
 		sort(bin_index.begin(), bin_index.end(),
 			[](const binstat& a, const binstat& b){ return a.second > b.second; });
 	}
 
 	void setDepthbuffer(struct SOADepth& db) {
-		this->db = &db;
+		frames[cur].db = &db;
 	}
 	void setColorbuffer(struct SOACanvas& cb) {
-		this->cb = &cb;
+		frames[cur].cb = &cb;
 	}
 	void setMaterialStore(class MaterialStore& materialstore) {
-		this->materialstore = &materialstore;
+		frames[cur].materialstore = &materialstore;
 	}
 	void setPasses(const int passes) {
-		this->passes = passes;
+		frames[cur].passes = passes;
 	}
 	void setTextureStore(class TextureStore& texturestore) {
-		this->texturestore = &texturestore;
+		frames[cur].texturestore = &texturestore;
 	}
 	void setTarget(TrueColorPixel * const __restrict target, const int target_width) {
-		this->target = target;
-		this->target_width = target_width;
+		frames[cur].target = target;
+		frames[cur].target_width = target_width;
 	}
 	Pipedata * getPipe() {
-		return &this->pipes[0];
+		return &frames[cur].pipes[0];
 	}
 
 private:
+	void spawn_raster(PipeFrame& frame);
+	void prepare_occlusion(PipeFrame& frame);
+	void choose_tile_size(const int width, const int height);
+
 	const int threads;
-	Pipedata pipes[16];
+	PipeFrame frames[2];
+	int cur;
+	PipelineMode mode;
+	const RasterKernels * kernels;
+	bool occlusion;
+	bool depth_prepass;
+	const HiZ * occluder;   // this frame's instances are tested against
 	std::vector<Meshy*> meshlist;
 	std::vector<const Viewport *> viewlist;
+	std::vector<std::function<void(Pipedata&, const int, const int)>> procedurals;
+
+	std::vector<vectorsse<MeshInstance>> instances;   // per meshlist entry
+	vectorsse<InstanceTree> instance_trees;           // per meshlist entry
+	std::vector<GeometryChunk> chunks;
+	std::atomic<int> chunk_cursor;
 
 	mat4 camera;
 	mat4 camera_inverse;
 
 	int framecounter;
-	const Viewdevice * vpd;
-	std::vector<binstat> bin_index;
 
-	struct SOADepth * db;
-	struct SOACanvas * cb;
-	class MaterialStore * materialstore;
-	int passes;
-	class TextureStore * texturestore;
-	TrueColorPixel * __restrict target;
-	int target_width;
+	struct {
+		int entries;     // bin entries, all bins
+		int heaviest;    // entries in the fullest bin
+		int triangles;   // distinct triangles binned
+	} binstats;          // of the most recently binned frame
 
-	std::atomic<unsigned> current_bin;
-	std::vector<std::thread> workers;
-	void workerthread(const int thread_number);
+	int tile_level;      // index into the tile size table
+	int tile_votes;      // consecutive frames that asked for another level
+	int tile_width, tile_height;
+	int tile_device_width, tile_device_height;
 
 	class Telemetry& telemetry;
+	std::unique_ptr<JobSystem> jobs;
 
 
 public:
-	bool clear_color_enable;
-	vec4 clear_color_rgb;
 	void clear(const bool enable, const vec4& c) {
-		clear_color_enable = enable;
-		clear_color_rgb = c;
+		frames[cur].clear_color_enable = enable;
+		frames[cur].clear_color_rgb = c;
 	}
 };
 
@@ -1,10 +1,11 @@
 
 #include "stdafx.h"
 
+#include <cmath>
 #include <iostream>
+#include <mutex>
 
 #include "rocket.h"
-#include "player.h"
 
 
 using namespace std;
@@ -32,7 +33,14 @@ Rocket::~Rocket()
 }
 
 
+/*
+ * the sync library builds track paths in a static buffer, so loads from
+ * several Rocket instances have to take turns
+ */
+mutex track_lock;
+
 const struct sync_track *Rocket::getTrack(const string trackname) {
+	lock_guard<mutex> guard(track_lock);
 	return sync_get_track(rocket, trackname.c_str());
 }
 
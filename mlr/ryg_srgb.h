@@ -5,6 +5,8 @@
 #ifndef __RYG_SRGB_H
 #define __RYG_SRGB_H
 
+#include <cmath>
+
 typedef unsigned int uint;
 typedef unsigned char uint8;
 
@@ -155,7 +157,7 @@ static __forceinline __m128i float_to_srgb8_SSE2(__m128 f)
     SSE_CONST4(c_mantmask, 0xff);
     SSE_CONST4(c_topscale, 0x02000000);
 
-    __m128i temp; // temp value (on stack)
+    __declspec(align(16)) uint temp[4]; // temp value (on stack)
 
     // Initial clamp
     __m128 zero = _mm_setzero_ps();
@@ -165,20 +167,20 @@ static __forceinline __m128i float_to_srgb8_SSE2(__m128 f)
     // Table index
     __m128i tabidx1 = _mm_srli_epi32(_mm_castps_si128(clamp2), 20);
     __m128i tabidx2 = _mm_and_si128(tabidx1, _CONST(c_tabmask));
-    _mm_store_si128(&temp, tabidx2);
+    _mm_store_si128((__m128i*)temp, tabidx2);
 
     // Table lookup
-    temp.m128i_u32[0] = fp32_to_srgb8_tab3[temp.m128i_u32[0]];
-    temp.m128i_u32[1] = fp32_to_srgb8_tab3[temp.m128i_u32[1]];
-    temp.m128i_u32[2] = fp32_to_srgb8_tab3[temp.m128i_u32[2]];
-    temp.m128i_u32[3] = fp32_to_srgb8_tab3[temp.m128i_u32[3]];
+    temp[0] = fp32_to_srgb8_tab3[temp[0]];
+    temp[1] = fp32_to_srgb8_tab3[temp[1]];
+    temp[2] = fp32_to_srgb8_tab3[temp[2]];
+    temp[3] = fp32_to_srgb8_tab3[temp[3]];
 
     // Linear part of ramp
     __m128 linear1 = _mm_mul_ps(clamp2, _CONSTF(c_linearsc));
     __m128i linear2 = _mm_cvtps_epi32(linear1);
 
     // Table finisher
-    __m128i tabval = _mm_load_si128(&temp);
+    __m128i tabval = _mm_load_si128((const __m128i*)temp);
     __m128i tabmult1 = _mm_srli_epi32(_mm_castps_si128(clamp2), 12);
     __m128i tabmult2 = _mm_and_si128(tabmult1, _CONST(c_mantmask));
     __m128i tabmult3 = _mm_or_si128(tabmult2, _CONST(c_topscale));
@@ -210,7 +212,7 @@ static __forceinline __m128i float_to_srgb8_var2_SSE2(__m128 f)
     SSE_CONST4(c_mantmask, 0xff);
     SSE_CONST4(c_topscale, 0x02000000);
 
-    __m128i temp; // temp value (on stack)
+    __declspec(align(16)) uint temp[4]; // temp value (on stack)
 
     // Initial clamp
     __m128 clamp1 = _mm_max_ps(f, _CONSTF(c_clampmin)); // limit to [clampmin,1-eps] - also nuke NaNs
@@ -218,16 +220,16 @@ static __forceinline __m128i float_to_srgb8_var2_SSE2(__m128 f)
 
     // Table index
     __m128i tabidx = _mm_srli_epi32(_mm_castps_si128(clamp2), 20);
-    _mm_store_si128(&temp, tabidx);
+    _mm_store_si128((__m128i*)temp, tabidx);
 
     // Table lookup
-    temp.m128i_u32[0] = fp32_to_srgb8_tab4[temp.m128i_i32[0] - (127-13)*8];
-    temp.m128i_u32[1] = fp32_to_srgb8_tab4[temp.m128i_i32[1] - (127-13)*8];
-    temp.m128i_u32[2] = fp32_to_srgb8_tab4[temp.m128i_i32[2] - (127-13)*8];
-    temp.m128i_u32[3] = fp32_to_srgb8_tab4[temp.m128i_i32[3] - (127-13)*8];
+    temp[0] = fp32_to_srgb8_tab4[temp[0] - (127-13)*8];
+    temp[1] = fp32_to_srgb8_tab4[temp[1] - (127-13)*8];
+    temp[2] = fp32_to_srgb8_tab4[temp[2] - (127-13)*8];
+    temp[3] = fp32_to_srgb8_tab4[temp[3] - (127-13)*8];
 
     // Finisher
-    __m128i tabval = _mm_load_si128(&temp);
+    __m128i tabval = _mm_load_si128((const __m128i*)temp);
     __m128i tabmult1 = _mm_srli_epi32(_mm_castps_si128(clamp2), 12);
     __m128i tabmult2 = _mm_and_si128(tabmult1, _CONST(c_mantmask));
     __m128i tabmult3 = _mm_or_si128(tabmult2, _CONST(c_topscale));
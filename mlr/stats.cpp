@@ -1,5 +1,8 @@
 
 #include "stdafx.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
 #include <iostream>
 #include <vector>
 
@@ -26,24 +29,68 @@ vector<int> telecolors = {
 };
 
 
+static void clear_stages(Teledata& item)
+{
+	for (int si = 0; si < TELESTAGE_COUNT; si++) {
+		item.stages[si] = 0;
+		item.first[si] = DBL_MAX;
+		item.last[si] = -DBL_MAX;
+	}
+}
+
+
+Telemetry::Telemetry(const int threads)
+	:threads(threads), data(threads), epoch(chrono::steady_clock::now()), frame_begin(0), frame(0), x(0)
+{
+	for (auto& item : data) {
+		item.ring.resize(telering_size);
+		item.head = 0;
+		item.last_mark = 0;
+		clear_stages(item);
+	}
+}
+
 void Telemetry::start()
 {
+	frame++;
+	frame_begin = now();
 	for (auto& item : data) {
-		item.markers.clear();
-		item.teletimer.reset();
+		item.last_mark = frame_begin;
+		clear_stages(item);
 	}
-	this->x = 0;
+	x.store(0, memory_order_relaxed);
+}
+
+__forceinline void Telemetry::record(Teledata& item, const Telestage stage, const double begin, const double end, const int bin, const int mesh)
+{
+	const unsigned head = item.head.load(memory_order_relaxed);
+	item.ring[head & (telering_size - 1)] = { begin, end, stage, bin, mesh, frame, x.load(memory_order_relaxed) };
+	item.head.store(head + 1, memory_order_release);
 }
 
 void Telemetry::mark(const int thread)
 {
 	auto& item = data[thread];
-	item.markers.push_back({ item.teletimer.delta() * 1000, this->x });
+	const double t = now();
+	record(item, TELESTAGE_MARK, item.last_mark, t, -1, -1);
+	item.last_mark = t;
+}
+
+double Telemetry::span(const int thread, const Telestage stage, const double begin, const int bin, const int mesh)
+{
+	auto& item = data[thread];
+	const double t = now();
+	record(item, stage, begin, t, bin, mesh);
+	item.stages[stage] += t - begin;
+	item.first[stage] = min(item.first[stage], begin);
+	item.last[stage] = max(item.last[stage], t);
+	item.last_mark = t;
+	return t;
 }
 
 void Telemetry::inc()
 {
-	x++;
+	x.fetch_add(1, memory_order_relaxed);
 }
 
 void Telemetry::end()
@@ -51,45 +98,105 @@ void Telemetry::end()
 }
 
 /*
-void Telemetry::print() const
+ * named values that hold until set again, e.g. the tile size
+ */
+void Telemetry::counter(const string& name, const double value)
 {
-	cout << "--------------" << endl;
-	for (auto& item : markers) {
-		cout << "x:" << item.x << ", t:" << boost::format("%.4f") % item.tm << endl;
+	for (auto& item : counters) {
+		if (item.name == name) {
+			item.value = value;
+			return;
+		}
 	}
+	counters.push_back({ name, value });
 }
-*/
 
+/*
+ * time spent in a stage since start(), summed over all threads
+ */
+double Telemetry::getStage(const Telestage which) const
+{
+	double ms = 0;
+	for (auto& item : data) {
+		ms += item.stages[which];
+	}
+	return ms;
+}
+
+/*
+ * wall time of a stage since start(), from its first span's begin on
+ * any thread to its last span's end.  0 if it did not run.
+ */
+double Telemetry::getStageElapsed(const Telestage which) const
+{
+	double first = DBL_MAX, last = -DBL_MAX;
+	for (auto& item : data) {
+		first = min(first, item.first[which]);
+		last = max(last, item.last[which]);
+	}
+	return last >= first ? last - first : 0;
+}
+
+const char * const telestage_names[TELESTAGE_COUNT + 1] = {
+	"geometry", "index_bins", "raster", "convert", "mark"
+};
+
+bool Telemetry::writeTrace(const string& filename) const
+{
+	FILE * const f = fopen(filename.c_str(), "w");
+	if (!f) return false;
+
+	fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	double last = 0;
+	for (int ti = 0; ti < threads; ti++) {
+		const auto& item = data[ti];
+		fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, \"args\": {\"name\": \"worker %d\"}},\n", ti, ti);
+
+		const unsigned head = item.head.load(memory_order_acquire);
+		const unsigned count = min(head, telering_size);
+		for (unsigned ei = head - count; ei != head; ei++) {
+			const auto& e = item.ring[ei & (telering_size - 1)];
+			// chrome wants microseconds
+			fprintf(f, "{\"name\": \"%s\", \"cat\": \"mlr\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %d",
+				telestage_names[e.stage], ti, e.begin * 1000, (e.end - e.begin) * 1000, e.frame);
+			if (e.bin >= 0) fprintf(f, ", \"bin\": %d", e.bin);
+			if (e.mesh >= 0) fprintf(f, ", \"mesh\": %d", e.mesh);
+			fprintf(f, "}},\n");
+			last = max(last, e.end);
+		}
+	}
+	for (auto& item : counters) {
+		fprintf(f, "{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 0, \"ts\": %.3f, \"args\": {\"value\": %g}},\n", item.name.c_str(), last * 1000, item.value);
+	}
+	// the format tolerates no trailing comma, so close with an empty metadata event
+	fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": {\"name\": \"mlr\"}}\n]}\n");
+	return fclose(f) == 0;
+}
+
+/*
+ * the current frame's events, one row per thread, placed by time
+ */
 void Telemetry::draw(const unsigned stride, TrueColorPixel * const __restrict dst) const
 {
 	const int offset = 5; //pixels
-	const int graph_width = stride - offset * 2;
-	//	const float ms_width = 40.0f;
 	const float factor = 20.0f;
 
 	int ypos = 40;
 	for (auto& t : data) {
-
-		int ci = 0;
-		int px = offset;
-		for (auto& item : t.markers) {
-//			if (ci == 0) {
-//				ci++; continue;
-//			}
-
-			int width = static_cast<int>(item.tm * factor + 0.5);
-			for (int i = 0; px < stride - offset && i < width; i++, px++) {
+		const unsigned head = t.head.load(memory_order_acquire);
+		const unsigned count = min(head, telering_size);
+		for (unsigned ei = head; ei != head - count; ei--) {
+			const auto& item = t.ring[(ei - 1) & (telering_size - 1)];
+			if (item.frame != frame) break;
+
+			const int x0 = offset + static_cast<int>((item.begin - frame_begin) * factor + 0.5);
+			const int x1 = offset + static_cast<int>((item.end - frame_begin) * factor + 0.5);
+			for (int px = max(x0, offset); px < x1 && px < int(stride) - offset; px++) {
 				for (int row = 0; row < 5; row++) {
-					dst[px + ((row + ypos)*stride)].integer = telecolors[item.x];
+					dst[px + ((row + ypos)*stride)].integer = telecolors[item.x % telecolors.size()];
 				}
 			}
-			if (width)
-				px += 1;
-
-			ci++;
 		}
 		ypos += 6;
-
 	}
-
-}
\ No newline at end of file
+}
@@ -3,39 +3,104 @@
 #define __STATS_H
 
 #include "stdafx.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "aligned_allocator.h"
 #include "PixelToaster.h"
 
 using namespace PixelToaster;
 
-struct Telemarker {
-	double tm;
-	int x;
+struct Telecounter {
+	std::string name;
+	double value;
 };
 
-struct Teledata {
-	std::vector<Telemarker> markers;
-	Timer teletimer;
+/*
+ * pipeline stages that worker time is accounted to
+ */
+enum Telestage {
+	TELESTAGE_GEOMETRY,     // flatten, planning, transform and binning
+	TELESTAGE_INDEX_BINS,
+	TELESTAGE_RASTER,       // rasterizing and shading the bins
+	TELESTAGE_CONVERT,      // canvas to target conversion
+	TELESTAGE_COUNT,
+	TELESTAGE_MARK = TELESTAGE_COUNT   // mark(), not a stage
+};
+
+/*
+ * one span of work on one thread, times in ms since the Telemetry was
+ * created
+ */
+struct Teleevent {
+	double begin, end;
+	int stage;   // Telestage
+	int bin;     // -1 when not about a bin
+	int mesh;    // Meshy index, -1 when not about a mesh
+	int frame;
+	int x;       // inc() count at the time, picks the color in draw()
+};
+
+const unsigned telering_size = 1 << 16;   // events kept per thread, power of two
+
+/*
+ * a thread's events.  only the owning thread writes, readers look at
+ * the last telering_size events below head.
+ */
+struct __declspec(align(64)) Teledata {
+	std::vector<Teleevent> ring;
+	std::atomic<unsigned> head;   // events written so far
+	double last_mark;
+	double stages[TELESTAGE_COUNT];   // ms since start()
+	double first[TELESTAGE_COUNT];    // earliest span begin since start()
+	double last[TELESTAGE_COUNT];     // latest span end since start()
 };
 
 class Telemetry {
 public:
-	Telemetry(const int threads) :threads(threads) {
-		data.resize(threads);
-	}
+	Telemetry(const int threads);
 
 	void start();
 	void mark(const int thread);
 	void inc();
 	void end();
-	void print() const;
+	void counter(const std::string& name, const double value);
+
+	/*
+	 * ms since the Telemetry was created, on a clock shared by all
+	 * threads.  time a stage with
+	 *   t1 = span(thread, stage, t0, bin, mesh)
+	 * which records the event, adds it to the stage total and returns
+	 * its end, for chaining into the next span.
+	 */
+	double now() const {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - epoch).count();
+	}
+	double span(const int thread, const Telestage stage, const double begin, const int bin = -1, const int mesh = -1);
+	double getStage(const Telestage which) const;
+	double getStageElapsed(const Telestage which) const;
+	const std::vector<Telecounter>& getCounters() const { return counters; }
+
+	/*
+	 * every event still in the rings, as chrome://tracing / perfetto
+	 * json.  call while no thread is recording.
+	 */
+	bool writeTrace(const std::string& filename) const;
+
 	void draw(const unsigned stride, TrueColorPixel * const __restrict dst) const;
 private:
+	void record(Teledata& item, const Telestage stage, const double begin, const double end, const int bin, const int mesh);
+
 	const int threads;
-	std::vector<Teledata> data;
-	int x;
+	vectorsse<Teledata> data;   // 64 byte aligned, so no two heads share a cache line
+	std::vector<Telecounter> counters;
+	std::chrono::steady_clock::time_point epoch;
+	double frame_begin;
+	int frame;
+	std::atomic<int> x;   // bumped by the binning job while raster jobs record
 };
 
 #endif //__STATS_H
-
@@ -5,11 +5,31 @@
 
 #pragma once
 
+#ifdef _MSC_VER
+
 #include "targetver.h"
 
 #include <stdio.h>
 #include <tchar.h>
 
+#else
+
+/*
+ * gcc/clang: spell the msvc extensions the code uses.
+ * __declspec(align(n)) has to follow the struct keyword to be honoured.
+ */
+#include <stdio.h>
+#include <assert.h>
+#include <immintrin.h>
+
+#define __forceinline inline __attribute__((always_inline))
+#define __declspec(x) __declspec_##x
+#define __declspec_align(n) __attribute__((aligned(n)))
+#define _ASSERT(x) assert(x)
+#define _getch getchar
+
+#endif
+
 
 
 // TODO: reference additional headers your program requires here
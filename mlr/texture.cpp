@@ -1,15 +1,17 @@
 
 #include "stdafx.h"
 #include <algorithm>
+#include <cstring>
 #include <boost/format.hpp>
 #include <fstream>
 
-#include <Windows.h>
 
 #include "ryg_srgb.h"
 
 #include "vec.h"
+#ifdef _MSC_VER
 #include "dib24.h"
+#endif
 #include "utils.h"
 #include "picopng.h"
 #include "texture.h"
@@ -53,6 +55,7 @@ Texture loadPng(const string filename, const string name, const bool premultiply
 	return{ pc, w, h, w, name };
 }
 
+#ifdef _MSC_VER
 Texture loadJpg(const string filename, const string name) {
 	
 	DIB24 dib;
@@ -75,6 +78,20 @@ Texture loadJpg(const string filename, const string name) {
 	}
 	return{ pc, dib.width, dib.height, dib.width, name };
 }
+#else
+Texture checkerboard2x2();
+
+/*
+ * jpeg decoding goes through the windows ole picture loader; elsewhere
+ * the texture is replaced by the checkerboard, under its own name
+ */
+Texture loadJpg(const string filename, const string name) {
+	cout << "texturestore: no jpeg loader on this platform, using a checkerboard for " << filename << endl;
+	Texture t = checkerboard2x2();
+	t.name = name;
+	return t;
+}
+#endif
 
 Texture checkerboard2x2() {
 	vectorsse<FloatingPointPixel> db;
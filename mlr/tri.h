@@ -4,28 +4,237 @@
 
 #include "stdafx.h"
 
+#include <cfloat>
 #include <cmath>
 
 #include "ryg_srgb.h"
 #include "vec_soa.h"
 #include "canvas.h"
 #include "vec.h"
+#include "vec8.h"
 
 using namespace PixelToaster;
 
-const ivec4 iqx(0,1,0,1);
-const ivec4 iqy(0,0,1,1);
-const vec4 fqx(0,1,0,1);
-const vec4 fqy(0,0,1,1);
+/*
+ * pixel offsets within a quad.  functions, not globals, since a global
+ * would be built before main() with the instructions of whichever file
+ * it's in, and the kernels are compiled for AVX2 too (see kernels.h)
+ */
+__forceinline ivec4 iqx() { return ivec4(0,1,0,1); }
+__forceinline ivec4 iqy() { return ivec4(0,0,1,1); }
+__forceinline vec4 fqx() { return vec4(0,1,0,1); }
+__forceinline vec4 fqy() { return vec4(0,0,1,1); }
+#ifdef __AVX2__
+__forceinline vec8 fox() { return vec8(0,1,0,1,2,3,2,3); }   // two quads side by side
+__forceinline vec8 foy() { return vec8(0,0,1,1,0,0,1,1); }
+#endif
 
 __forceinline int iround(const float x)
 {
-	int t;
-	__asm {
-		fld x
-		fistp t
+	// round to nearest, like fistp with the default control word
+	return _mm_cvt_ss2si(_mm_set_ss(x));
+}
+
+
+/*
+ * an edge function in 28.4 fixed point, without the tile.  at pixel
+ * (x, y) it is k + dy*x + dx*y, >= 0 inside, with the top/left fill
+ * convention and the >>4 already folded into k
+ */
+struct TriEdge {
+	int dx, dy, k;
+
+	void setup(const int x1, const int y1, const int x2, const int y2) {
+		dx = x1 - x2;
+		dy = y2 - y1;
+
+		int c = -dy*x1 - dx*y1;
+
+		// correct for top/left fill convention
+		if (dy > 0 || (dy == 0 && dx > 0)) c++;
+
+		// (16*(dy*x + dx*y) + c - 1) >> 4 == dy*x + dx*y + ((c - 1) >> 4)
+		k = (c - 1) >> 4;
+	}
+};
+
+
+/*
+ * an edge function in homogeneous device coordinates, after Olano and
+ * Greer.  there is no division by w, so it holds for vertices anywhere
+ * in front of the near plane.  a*x + b*y + c at pixel (x, y) is >= 0
+ * inside, and the three of them, divided by their sum, are the screen
+ * space barycentrics
+ */
+struct TriEdgeH {
+	float a, b, c;
+};
+
+
+__forceinline int pixel_bound(const float x)
+{
+	// ceil, for coordinates far outside of any canvas too
+	return int(ceilf(std::min(std::max(x, -16777216.0f), 16777216.0f)));
+}
+
+
+/*
+ * everything about a triangle that does not depend on the tile it is
+ * drawn into.  set up once when the triangle is binned, each tile only
+ * moves the edge constants to its own start.
+ */
+struct __declspec(align(16)) TriSetup {
+	vec4 invw;     // of the three vertices, for perspective correction
+	vec4 depth;    // depth buffer values of the three vertices
+	union {
+		TriEdge edge[3];
+		TriEdgeH hedge[3];   // if homogeneous
+	};
+	int minx, maxx, miny, maxy;   // pixel bounds, before clipping to the tile
+	float scale;   // 1 / the sum of the edge functions, for barycentrics
+	int homogeneous;   // edges are hedge[], for triangles past the guard band
+
+	void setup(const vec4& s1, const vec4& s2, const vec4& s3) {
+		homogeneous = 0;
+
+		const int x1 = iround(16.0f * s1.x);
+		const int x2 = iround(16.0f * s2.x);
+		const int x3 = iround(16.0f * s3.x);
+
+		const int y1 = iround(16.0f * s1.y);
+		const int y2 = iround(16.0f * s2.y);
+		const int y3 = iround(16.0f * s3.y);
+
+		minx = (std::min(std::min(x1,x2),x3) + 0xf) >> 4;
+		maxx = (std::max(std::max(x1,x2),x3) + 0xf) >> 4;
+		miny = (std::min(std::min(y1,y2),y3) + 0xf) >> 4;
+		maxy = (std::max(std::max(y1,y2),y3) + 0xf) >> 4;
+
+		edge[0].setup(x1, y1, x2, y2);
+		edge[1].setup(x2, y2, x3, y3);
+		edge[2].setup(x3, y3, x1, y1);
+
+		// the position dependent parts cancel out around the triangle
+		scale = 1.0f / (edge[0].k + edge[1].k + edge[2].k);
+
+		invw = vec4(s1.w, s2.w, s3.w, 0);
+		depth = (-vec4(s1.z, s2.z, s3.z, 0) + vec4(1)) * vec4(0.5f);
+	}
+
+	/*
+	 * the same from h, the vertices as clip_to_screen() leaves them, and
+	 * s, as clip_to_device() does.  the vertices can be far outside of
+	 * the guard band, but all w must be > 0.  false if the triangle is
+	 * back facing or degenerate.
+	 */
+	bool setup_homogeneous(const vec4& h1, const vec4& h2, const vec4& h3, const vec4& s1, const vec4& s2, const vec4& s3) {
+		const double X[3] = { h1.x, h2.x, h3.x };
+		const double Y[3] = { h1.y, h2.y, h3.y };
+		const double W[3] = { h1.w, h2.w, h3.w };
+
+		// edge i runs from vertex i to i+1, as in setup()
+		double a[3], b[3], c[3];
+		for (int i = 0; i < 3; i++) {
+			const int j = (i + 1) % 3;
+			a[i] = Y[i]*W[j] - W[i]*Y[j];
+			b[i] = W[i]*X[j] - X[i]*W[j];
+			c[i] = X[i]*Y[j] - Y[i]*X[j];
+		}
+
+		// the edges are negative inside a front facing triangle
+		const double det = a[0]*X[2] + b[0]*Y[2] + c[0]*W[2];
+		if (!(det < 0)) return false;
+
+		// weighted by the w of the opposite vertex, they sum up to the
+		// screen space barycentrics instead of the perspective correct ones
+		for (int i = 0; i < 3; i++) {
+			const double weight = -W[(i + 2) % 3];
+			hedge[i].a = float(a[i] * weight);
+			hedge[i].b = float(b[i] * weight);
+			hedge[i].c = float(c[i] * weight);
+		}
+		homogeneous = 1;
+
+		minx = pixel_bound(std::min(std::min(s1.x, s2.x), s3.x));
+		maxx = pixel_bound(std::max(std::max(s1.x, s2.x), s3.x));
+		miny = pixel_bound(std::min(std::min(s1.y, s2.y), s3.y));
+		maxy = pixel_bound(std::max(std::max(s1.y, s2.y), s3.y));
+		scale = 0;
+
+		invw = vec4(s1.w, s2.w, s3.w, 0);
+		depth = (-vec4(s1.z, s2.z, s3.z, 0) + vec4(1)) * vec4(0.5f);
+		return true;
 	}
-	return t;
+};
+
+
+/*
+ * TriSetup::setup() for four triangles at once.  lane j of s[i] is
+ * vertex i of triangle j, as clip_to_device() leaves it, and out[j]
+ * where its setup goes.  the results are exactly those of setup(), one
+ * triangle at a time.  returns a bit
+ * per triangle that is front facing; back facing ones are set up too,
+ * but are not for drawing.
+ */
+__forceinline int triangle_setup4(const qfloat4 * const s, TriSetup * const * const out)
+{
+	const vec4 d31x = s[2].v[0] - s[0].v[0], d31y = s[2].v[1] - s[0].v[1];
+	const vec4 d21x = s[1].v[0] - s[0].v[0], d21y = s[1].v[1] - s[0].v[1];
+	const vec4 area = d31x*d21y - d31y*d21x;
+	const int front = ~cmplt(area, vec4::zero()).mask() & 0xf;
+
+	ivec4 x[3], y[3];
+	for (int i = 0; i < 3; i++) {
+		x[i] = ftoi_round(vec4(16.0f) * s[i].v[0]);
+		y[i] = ftoi_round(vec4(16.0f) * s[i].v[1]);
+	}
+
+	const ivec4 fifteen(0xf);
+	const ivec4 minx = sar<4>(vmin(vmin(x[0], x[1]), x[2]) + fifteen);
+	const ivec4 maxx = sar<4>(vmax(vmax(x[0], x[1]), x[2]) + fifteen);
+	const ivec4 miny = sar<4>(vmin(vmin(y[0], y[1]), y[2]) + fifteen);
+	const ivec4 maxy = sar<4>(vmax(vmax(y[0], y[1]), y[2]) + fifteen);
+
+	// TriEdge::setup() for edge i, from vertex i to i+1
+	ivec4 dx[3], dy[3], k[3];
+	for (int i = 0; i < 3; i++) {
+		const int j = (i + 1) % 3;
+		dx[i] = x[i] - x[j];
+		dy[i] = y[j] - y[i];
+		const ivec4 c = (ivec4(0) - dy[i]) * x[i] - dx[i] * y[i];
+
+		// top/left fill convention, c++ where it's all ones
+		const ivec4 topleft = cmpgt(dy[i], ivec4(0)) | (cmpeq(dy[i], ivec4(0)) & cmpgt(dx[i], ivec4(0)));
+		k[i] = sar<4>(c - topleft - ivec4(1));
+	}
+	__declspec(align(16)) float scale[4];
+	_mm_store_ps(scale, (vec4(1.0f) / itof(k[0] + k[1] + k[2])).v);
+
+	// per triangle, the three vertices' values and a zero
+	__m128 invw[4] = { s[0].v[3].v, s[1].v[3].v, s[2].v[3].v, vec4::zero().v };
+	__m128 depth[4] = {
+		((-s[0].v[2] + vec4(1)) * vec4(0.5f)).v,
+		((-s[1].v[2] + vec4(1)) * vec4(0.5f)).v,
+		((-s[2].v[2] + vec4(1)) * vec4(0.5f)).v,
+		((-vec4::zero() + vec4(1)) * vec4(0.5f)).v };
+	_MM_TRANSPOSE4_PS(invw[0], invw[1], invw[2], invw[3]);
+	_MM_TRANSPOSE4_PS(depth[0], depth[1], depth[2], depth[3]);
+
+	for (int t = 0; t < 4; t++) {
+		TriSetup& ts = *out[t];
+		ts.homogeneous = 0;
+		ts.minx = minx.si[t];  ts.maxx = maxx.si[t];
+		ts.miny = miny.si[t];  ts.maxy = maxy.si[t];
+		for (int i = 0; i < 3; i++) {
+			ts.edge[i].dx = dx[i].si[t];
+			ts.edge[i].dy = dy[i].si[t];
+			ts.edge[i].k = k[i].si[t];
+		}
+		ts.scale = scale[t];
+		ts.invw = invw[t];
+		ts.depth = depth[t];
+	}
+	return front;
 }
 
 
@@ -34,21 +243,13 @@ struct Edge {
 	ivec4 b, block_left_start;
 	ivec4 bdx, bdy;
 
-	void setup(const int x1, const int y1, const int x2, const int y2, const int startx, const int starty) {
-		const int dx = x1 - x2;
-		const int dy = y2 - y1;
-		
-		c = dy*((startx << 4) - x1) + dx*((starty << 4) - y1);
+	__forceinline void setup(const TriEdge& te, const int startx, const int starty) {
+		c = te.k + te.dy*startx + te.dx*starty;
 
-		// correct for top/left fill convention
-		if (dy > 0 || (dy == 0 && dx > 0)) c++;
-
-		c = (c - 1) >> 4;
-
-		block_left_start = ivec4(c) + iqx*dy + iqy*dx;
+		block_left_start = ivec4(c) + iqx()*te.dy + iqy()*te.dx;
 		b = block_left_start;
-		bdx = ivec4(dy * 2);
-		bdy = ivec4(dx * 2);
+		bdx = ivec4(te.dy * 2);
+		bdy = ivec4(te.dx * 2);
 	}
 
 	__forceinline void inc_y() {
@@ -78,56 +279,256 @@ struct Edge {
 };
 
 
+/*
+ * draw_triangle() for TriSetup::homogeneous.  the edges are evaluated
+ * in float, relative to the first block so that they keep their
+ * precision near the tile, and the top/left rule breaks exact ties.
+ */
 template <typename FRAGMENT_PROCESSOR>
-void draw_triangle(const irect& r, const vec4& s1, const vec4& s2, const vec4& s3, FRAGMENT_PROCESSOR& fp)
+void draw_triangle_homogeneous(const irect& r, const TriSetup& ts, FRAGMENT_PROCESSOR& fp)
 {
-	const int x1 = iround(16.0f * s1.x);
-	const int x2 = iround(16.0f * s2.x);
-	const int x3 = iround(16.0f * s3.x);
+	int minx = std::max(ts.minx, r.x0);
+	int maxx = std::min(ts.maxx, r.x1);
+	int miny = std::max(ts.miny, r.y0);
+	int maxy = std::min(ts.maxy, r.y1);
+
+	minx &= ~1; // align to 2x2 block
+	miny &= ~1;
+
+	vec4 ea[3], eb[3], ec[3], tie[3];
+	for (int i = 0; i < 3; i++) {
+		const TriEdgeH& he = ts.hedge[i];
+		ea[i] = vec4(he.a);
+		eb[i] = vec4(he.b);
+		ec[i] = vec4(float(double(he.c) + double(he.a)*minx + double(he.b)*miny));
+		const bool topleft = he.a > 0 || (he.a == 0 && he.b > 0);
+		tie[i] = topleft ? vec4::zero() : bits2float(ivec4(-1));
+	}
 
-	const int y1 = iround(16.0f * s1.y);
-	const int y2 = iround(16.0f * s2.y);
-	const int y3 = iround(16.0f * s3.y);
+	fp.goto_xy(minx, miny);
 
-	int minx = max((min(min(x1,x2),x3) + 0xf) >> 4, r.x0);
-	int maxx = min((max(max(x1,x2),x3) + 0xf) >> 4, r.x1);
-	int miny = max((min(min(y1,y2),y3) + 0xf) >> 4, r.y0);
-	int maxy = min((max(max(y1,y2),y3) + 0xf) >> 4, r.y1);
+	for (int y = miny; y < maxy; y += 2, fp.inc_y()) {
+		const vec4 fy = vec4(float(y - miny)) + fqy();
+		for (int x = minx; x < maxx; x += 2, fp.inc_x()) {
+			const vec4 fx = vec4(float(x - minx)) + fqx();
 
-	const int q = 2; // block size is 2x2
-	minx &= ~(q - 1); // align to 2x2 block
-	miny &= ~(q - 1);
+			vec4 e[3];
+			vec4 outside = vec4::zero();
+			for (int i = 0; i < 3; i++) {
+				e[i] = ea[i]*fx + eb[i]*fy + ec[i];
+				outside = outside | cmplt(e[i], vec4::zero()) | (cmple(e[i], vec4::zero()) & tie[i]);
+			}
+			if (outside.mask() == 0xf) continue;
+			const ivec4 trimask(float2bits(outside));
 
-	Edge e[3];
-	e[0].setup(x1, y1, x2, y2, minx, miny);
-	e[1].setup(x2, y2, x3, y3, minx, miny);
-	e[2].setup(x3, y3, x1, y1, minx, miny);
+			qfloat2 frag_coord = { vec4(x+0.5f)+fqx(), vec4(y+0.5f)+fqy() };
 
-	const float _s = 1.0f / (e[0].c + e[1].c + e[2].c);
-	const vec4 scale(_s);
+			// outside lanes get zeros rather than whatever the division left
+			const vec4 inv = vec4(1.0f) / vmax(e[0] + e[1] + e[2], vec4(FLT_MIN));
+			vertex_float bary;
+			bary.x[0] = bits2float(andnot(trimask, float2bits(e[1] * inv)));
+			bary.x[2] = bits2float(andnot(trimask, float2bits(e[0] * inv)));
+			bary.x[1] = vec4(1.0f) - (bary.x[0] + bary.x[2]);
 
-	fp.goto_xy(minx, miny);
+			fp.render(frag_coord, trimask, bary);
+		}
+	}
+}
 
-	for (int y = miny; y < maxy; y += 2, e[0].inc_y(), e[1].inc_y(), e[2].inc_y(), fp.inc_y()) {
-		for (int x = minx; x < maxx; x += 2, e[0].inc_x(), e[1].inc_x(), e[2].inc_x(), fp.inc_x()) {
 
+const int raster_block = 8;   // pixels, blocks are classified as a whole
+const int raster_block_min = 64;   // smaller bounds are walked quad by quad
+
+/*
+ * the quads of row y from x to x1.  with FULL every pixel is known to
+ * be inside, so the edges are only stepped for the barycentrics.
+ */
+template <bool FULL, typename FRAGMENT_PROCESSOR>
+__forceinline void draw_quads(Edge * const e, const vec4& scale, int x, const int x1, const int y, FRAGMENT_PROCESSOR& fp)
+{
+#ifdef __AVX2__
+	// two quads at a time while both are in the run, never past it, as
+	// the quads beyond can be another tile's
+	if (x + 2 < x1) {
+		ivec8 b[3], bdx[3];
+		for (int i = 0; i < 3; i++) {
+			b[i] = ivec8(e[i].b, e[i].b + e[i].bdx);
+			bdx[i] = ivec8(e[i].bdx + e[i].bdx, e[i].bdx + e[i].bdx);
+		}
+		const vec8 scale8(vec8::twice(scale));
+
+		for (; x + 2 < x1; x += 4, b[0] += bdx[0], b[1] += bdx[1], b[2] += bdx[2], fp.inc_x(), fp.inc_x()) {
+
+			ivec8 trimask(0);
+			if (!FULL) {
+				const ivec8 edges(b[0] | b[1] | b[2]);
+				if (movemask(bits2float(edges)) == 0xff) continue;
+				trimask = sar<31>(edges);
+			}
+
+			ofloat2 frag_coord = { { vec8(x+0.5f)+fox(), vec8(y+0.5f)+foy() } };
+
+			vertex_float8 bary;
+			bary.x[0] = itof(b[1]) * scale8;
+			bary.x[2] = itof(b[0]) * scale8;
+			bary.x[1] = vec8(1.0f) - (bary.x[0] + bary.x[2]);
+
+			fp.render8(frag_coord, trimask, bary);
+		}
+
+		for (int i = 0; i < 3; i++) e[i].b = b[i].lo();
+	}
+#endif
+	for (; x < x1; x += 2, e[0].inc_x(), e[1].inc_x(), e[2].inc_x(), fp.inc_x()) {
+
+		ivec4 trimask(0);
+		if (!FULL) {
 			const ivec4 edges(e[0].val() | e[1].val() | e[2].val());
 			if (movemask(bits2float(edges)) == 0xf) continue;
-			const ivec4 trimask(sar<31>(edges));
+			trimask = sar<31>(edges);
+		}
 
-			qfloat2 frag_coord = { vec4(x+0.5f)+fqx, vec4(y+0.5f)+fqy };
+		qfloat2 frag_coord = { vec4(x+0.5f)+fqx(), vec4(y+0.5f)+fqy() };
 
-			vertex_float bary;
-			bary.x[0] = itof(e[1].val()) * scale;
-			bary.x[2] = itof(e[0].val()) * scale;
-			bary.x[1] = vec4(1.0f) - (bary.x[0] + bary.x[2]);
+		vertex_float bary;
+		bary.x[0] = itof(e[1].val()) * scale;
+		bary.x[2] = itof(e[0].val()) * scale;
+		bary.x[1] = vec4(1.0f) - (bary.x[0] + bary.x[2]);
 
-			fp.render(frag_coord, trimask, bary);
+		fp.render(frag_coord, trimask, bary);
+	}
+}
+
+
+/*
+ * every quad of the bounds, minx and miny aligned to quads
+ */
+template <typename FRAGMENT_PROCESSOR>
+void draw_triangle_quads(const int minx, const int maxx, const int miny, const int maxy, const TriSetup& ts, FRAGMENT_PROCESSOR& fp)
+{
+	Edge e[3];
+	e[0].setup(ts.edge[0], minx, miny);
+	e[1].setup(ts.edge[1], minx, miny);
+	e[2].setup(ts.edge[2], minx, miny);
+
+	const vec4 scale(ts.scale);
+
+	fp.goto_xy(minx, miny);
+
+	for (int y = miny; y < maxy; y += 2, e[0].inc_y(), e[1].inc_y(), e[2].inc_y(), fp.inc_y()) {
+		draw_quads<false>(e, scale, minx, maxx, y, fp);
+	}
+}
+
+
+/*
+ * the same in bands of 8 rows, classifying the 8x8 pixel blocks of
+ * each band.  the edge functions are linear, so their values at the
+ * corners of a block bound them over all of it: a block with an edge
+ * negative at every corner is empty, one with all edges positive at
+ * every corner is full.  the triangle is convex, so along a band the
+ * blocks that are not empty are a single run, and so are the full ones
+ * inside of it.  the rows of a band then skip the empty runs, and draw
+ * the full run without masks.
+ */
+template <typename FRAGMENT_PROCESSOR>
+void draw_triangle_blocks(const int minx, const int maxx, const int miny, const int maxy, const TriSetup& ts, FRAGMENT_PROCESSOR& fp)
+{
+	const vec4 scale(ts.scale);
+	const int span = raster_block - 1;
+
+	int lo[3], hi[3];
+	for (int i = 0; i < 3; i++) {
+		const TriEdge& te = ts.edge[i];
+		lo[i] = std::min(te.dy*span, 0) + std::min(te.dx*span, 0);
+		hi[i] = std::max(te.dy*span, 0) + std::max(te.dx*span, 0);
+	}
+
+	for (int y0 = miny; y0 < maxy; ) {
+		const int by = y0 & ~span;
+		const int y1 = std::min(by + raster_block, maxy);
+
+		// the runs of blocks that are not empty and that are full
+		int xl = maxx, xr = minx, fl = maxx, fr = minx;
+		for (int bx = minx & ~span; bx < maxx; bx += raster_block) {
+			bool full = true, empty = false;
+			for (int i = 0; i < 3; i++) {
+				const TriEdge& te = ts.edge[i];
+				const int c = te.k + te.dy*bx + te.dx*by;
+				full &= c + lo[i] >= 0;
+				empty |= c + hi[i] < 0;
+			}
+			if (empty) continue;
+			xl = std::min(xl, bx);
+			xr = bx + raster_block;
+			if (full) {
+				fl = std::min(fl, bx);
+				fr = bx + raster_block;
+			}
+		}
+		xl = std::max(xl, minx);
+		xr = std::min(xr, maxx);
+		if (fl >= fr) fl = fr = xr;
+		fl = std::max(fl, xl);
+		fr = std::min(fr, xr);
+
+		if (xl < xr) {
+			Edge e[3];
+			e[0].setup(ts.edge[0], xl, y0);
+			e[1].setup(ts.edge[1], xl, y0);
+			e[2].setup(ts.edge[2], xl, y0);
+
+			fp.goto_xy(xl, y0);
+
+			for (int y = y0; y < y1; y += 2, e[0].inc_y(), e[1].inc_y(), e[2].inc_y(), fp.inc_y()) {
+				draw_quads<false>(e, scale, xl, fl, y, fp);
+				draw_quads<true>(e, scale, fl, fr, y, fp);
+				draw_quads<false>(e, scale, fr, xr, y, fp);
+			}
 		}
+		y0 = y1;
+	}
+}
+
+
+/*
+ * small triangles are not worth classifying blocks for, the setup of
+ * each band and the short runs cost more than the quad tests they save
+ */
+template <typename FRAGMENT_PROCESSOR>
+void draw_triangle(const irect& r, const TriSetup& ts, FRAGMENT_PROCESSOR& fp)
+{
+	if (ts.homogeneous) {
+		draw_triangle_homogeneous(r, ts, fp);
+		return;
+	}
+
+	int minx = std::max(ts.minx, r.x0);
+	int maxx = std::min(ts.maxx, r.x1);
+	int miny = std::max(ts.miny, r.y0);
+	int maxy = std::min(ts.maxy, r.y1);
+
+	const int q = 2; // block size is 2x2
+	minx &= ~(q - 1); // align to 2x2 block
+	miny &= ~(q - 1);
+
+	if (maxx - minx >= raster_block_min && maxy - miny >= raster_block_min) {
+		draw_triangle_blocks(minx, maxx, miny, maxy, ts, fp);
+	} else {
+		draw_triangle_quads(minx, maxx, miny, maxy, ts, fp);
 	}
 }
 
 
+template <typename FRAGMENT_PROCESSOR>
+void draw_triangle(const irect& r, const vec4& s1, const vec4& s2, const vec4& s3, FRAGMENT_PROCESSOR& fp)
+{
+	TriSetup ts;
+	ts.setup(s1, s2, s3);
+	draw_triangle(r, ts, fp);
+}
+
+
 template <typename FRAGMENT_PROCESSOR>
 void draw_rectangle(const irect& r, FRAGMENT_PROCESSOR& fp)
 {
@@ -143,7 +544,7 @@ void draw_rectangle(const irect& r, FRAGMENT_PROCESSOR& fp)
 	fp.goto_xy(minx, miny);
 	for (int y = miny; y < maxy; y += 2, fp.inc_y())
 	for (int x = minx; x < maxx; x += 2, fp.inc_x()) {
-		qfloat2 frag_coord = { vec4(x+0.5f)+fqx, vec4(y+0.5f)+fqy };
+		qfloat2 frag_coord = { vec4(x+0.5f)+fqx(), vec4(y+0.5f)+fqy() };
 		fp.render(frag_coord);
 	}
 }
@@ -101,10 +101,10 @@ void hdrawTri(const irect r, const vec4& s1, const vec4& s2, const vec4& s3, FRA
 	const int y2 = iround(16.0f * s2.y);
 	const int y3 = iround(16.0f * s3.y);
 
-	int minx = max((min(min(x1, x2), x3) + 0xf) >> 4, r.x0);
-	int miny = max((min(min(y1, y2), y3) + 0xf) >> 4, r.y0);
-	int maxx = min((max(max(x1, x2), x3) + 0xf) >> 4, r.x1);
-	int maxy = min((max(max(y1, y2), y3) + 0xf) >> 4, r.y1);
+	int minx = std::max((std::min(std::min(x1, x2), x3) + 0xf) >> 4, r.x0);
+	int miny = std::max((std::min(std::min(y1, y2), y3) + 0xf) >> 4, r.y0);
+	int maxx = std::min((std::max(std::max(x1, x2), x3) + 0xf) >> 4, r.x1);
+	int maxy = std::min((std::max(std::max(y1, y2), y3) + 0xf) >> 4, r.y1);
 
 	const int q = 8;
 	minx &= ~(q - 1);
@@ -1,14 +1,25 @@
 
-//#include "utils.h"
 #include "stdafx.h"
 
+#include <mutex>
 #include <vector>
 #include <codecvt>
 #include <fstream>
 #include <iostream>
 #include <boost/format.hpp>
 
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <glob.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "utils.h"
 
 using namespace std;
 using boost::format;
@@ -27,6 +38,7 @@ string ws2s(const wstring& wstr)
 	return converterX.to_bytes(wstr);
 }
 
+#ifdef _WIN32
 vector<string> fileglob(const string& pathpat) {
 	vector<string> lst;
 	WIN32_FIND_DATA ffd;
@@ -40,6 +52,21 @@ vector<string> fileglob(const string& pathpat) {
 	}
 	return lst;
 }
+#else
+vector<string> fileglob(const string& pathpat) {
+	vector<string> lst;
+	glob_t g;
+	if (glob(pathpat.c_str(), GLOB_MARK, nullptr, &g) == 0) {
+		for (size_t i = 0; i < g.gl_pathc; i++) {
+			string path(g.gl_pathv[i]);
+			if (path.back() == '/') continue; // directory
+			lst.push_back(path.substr(path.rfind('/') + 1)); // names only, like FindFirstFile
+		}
+	}
+	globfree(&g);
+	return lst;
+}
+#endif
 
 vector<string> explode(const string& str, char ch) {
 	vector<string> items;
@@ -60,6 +87,7 @@ vector<string> explode(const string& str, char ch) {
 * example from
 * http://nickperrysays.wordpress.com/2011/05/24/monitoring-a-file-last-modified-date-with-visual-c/
 */
+#ifdef _WIN32
 long long getmtime(const string& fn) {
 	long long mtime = -1;
 	HANDLE hFile = CreateFileA(fn.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
@@ -74,6 +102,13 @@ long long getmtime(const string& fn) {
 	}
 	return mtime;
 }
+#else
+long long getmtime(const string& fn) {
+	struct stat st;
+	if (stat(fn.c_str(), &st) != 0) return -1;
+	return (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+#endif
 
 
 vector<char> file_get_contents(const string& fn) {
@@ -103,14 +138,164 @@ void file_get_contents(const string& fn, vector<char>& buf) {
 }
 
 
+/*
+ * logical processors in binding order: for every physical core its
+ * first logical processor, then the remaining SMT siblings.  on windows
+ * the table covers all processor groups, so machines with more than 64
+ * logical processors are fully usable.
+ */
+#ifdef _WIN32
+struct LogicalCpu {
+	WORD group;
+	BYTE number;
+};
+#else
+struct LogicalCpu {
+	int number;
+};
+#endif
+
+CpuBindPolicy bind_policy = CPU_BIND_CORES;
+vector<LogicalCpu> cpu_order;
+unsigned core_count = 0;
+once_flag cpu_topology_once;
+
+#ifdef _WIN32
+vector<vector<LogicalCpu>> read_cores()
+{
+	vector<vector<LogicalCpu>> cores;
+
+	DWORD len = 0;
+	GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &len);
+	vector<char> buf(len);
+	auto base = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buf.data());
+	if (len == 0 || !GetLogicalProcessorInformationEx(RelationProcessorCore, base, &len)) {
+		SYSTEM_INFO si = { 0, };
+		GetSystemInfo(&si);
+		for (unsigned i = 0; i < si.dwNumberOfProcessors; i++) {
+			cores.push_back({ { 0, BYTE(i) } });
+		}
+		return cores;
+	}
+
+	for (DWORD pos = 0; pos < len;) {
+		auto info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buf.data() + pos);
+		vector<LogicalCpu> siblings;
+		for (int gi = 0; gi < info->Processor.GroupCount; gi++) {
+			const auto& gm = info->Processor.GroupMask[gi];
+			for (int bit = 0; bit < int(sizeof(KAFFINITY) * 8); bit++) {
+				if (gm.Mask & (KAFFINITY(1) << bit)) {
+					siblings.push_back({ gm.Group, BYTE(bit) });
+				}
+			}
+		}
+		if (!siblings.empty()) cores.push_back(siblings);
+		pos += info->Size;
+	}
+	return cores;
+}
+#else
+int read_sysfs_int(const string& fn)
+{
+	ifstream f(fn);
+	int val = -1;
+	f >> val;
+	return f ? val : -1;
+}
+
+/*
+ * group the cpus this process may run on by (package, core), as
+ * reported by sysfs.  without sysfs every cpu counts as a core.
+ */
+vector<vector<LogicalCpu>> read_cores()
+{
+	vector<vector<LogicalCpu>> cores;
+	vector<pair<int, int>> keys;
+
+	const int ncpu = sysconf(_SC_NPROCESSORS_CONF);
+#ifdef __linux__
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	const bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+#endif
+	for (int cpu = 0; cpu < ncpu; cpu++) {
+#ifdef __linux__
+		if (have_mask && !CPU_ISSET(cpu, &allowed)) continue;
+#endif
+		const string topo = (format("/sys/devices/system/cpu/cpu%d/topology/") % cpu).str();
+		const int package = read_sysfs_int(topo + "physical_package_id");
+		const int core = read_sysfs_int(topo + "core_id");
+		const auto key = core < 0 ? make_pair(-1, cpu) : make_pair(package, core);
+
+		auto found = find(keys.begin(), keys.end(), key);
+		if (found == keys.end()) {
+			keys.push_back(key);
+			cores.push_back({ { cpu } });
+		} else {
+			cores[found - keys.begin()].push_back({ cpu });
+		}
+	}
+	if (cores.empty()) {
+		cores.push_back({ { 0 } });
+	}
+	return cores;
+}
+#endif
+
+/*
+ * filled on first use, which may be every worker binding itself at
+ * once; after that cpu_order and core_count are only read
+ */
+void read_cpu_topology()
+{
+	call_once(cpu_topology_once, [] {
+		const auto cores = read_cores();
+		core_count = cores.size();
+		for (size_t smt = 0;; smt++) {
+			bool any = false;
+			for (auto& siblings : cores) {
+				if (smt < siblings.size()) {
+					cpu_order.push_back(siblings[smt]);
+					any = true;
+				}
+			}
+			if (!any) break;
+		}
+	});
+}
+
+
+void set_cpu_bind_policy(const CpuBindPolicy policy)
+{
+	bind_policy = policy;
+}
+
+CpuBindPolicy get_cpu_bind_policy()
+{
+	return bind_policy;
+}
+
+bool cpu_bind_policy_from_name(const string& name, CpuBindPolicy& policy)
+{
+	if (name == "cores") {
+		policy = CPU_BIND_CORES;
+	} else if (name == "threads") {
+		policy = CPU_BIND_THREADS;
+	} else if (name == "none") {
+		policy = CPU_BIND_NONE;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+
 unsigned get_cpu_count() {
-	//return 1;
-	SYSTEM_INFO si = { 0, };
-	GetSystemInfo(&si);
-	if (1)
-		return si.dwNumberOfProcessors / 2;
+	read_cpu_topology();
+	if (bind_policy == CPU_BIND_CORES)
+		return core_count;
 	else
-		return si.dwNumberOfProcessors;
+		return cpu_order.size();
 }
 
 
@@ -123,10 +308,61 @@ void sse_configure()
 
 void bind_to_cpu(const unsigned cpu)
 {
-	const HANDLE self = GetCurrentThread();
-	if (1) {
-		DWORD_PTR pmask = SetThreadAffinityMask(self, 1 << (cpu*2));
-	} else {
-		DWORD_PTR pmask = SetThreadAffinityMask(self, 1 << cpu);
+	if (bind_policy == CPU_BIND_NONE) return;
+	read_cpu_topology();
+
+	const auto& target = cpu_order[cpu % cpu_order.size()];
+#ifdef _WIN32
+	GROUP_AFFINITY ga = { 0, };
+	ga.Group = target.group;
+	ga.Mask = KAFFINITY(1) << target.number;
+	SetThreadGroupAffinity(GetCurrentThread(), &ga, nullptr);
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(target.number, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+
+/*
+ * allocate memory on the numa node of the calling thread.  intended for
+ * per-worker state, called from the worker itself after bind_to_cpu().
+ * page granular, so only use it for long-lived blocks.
+ */
+#ifdef _WIN32
+void* alloc_local(const size_t size)
+{
+	PROCESSOR_NUMBER pn;
+	GetCurrentProcessorNumberEx(&pn);
+	USHORT node = 0;
+	if (!GetNumaProcessorNodeEx(&pn, &node)) {
+		return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
 	}
+	return VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+}
+
+void free_local(void * const ptr, const size_t size)
+{
+	VirtualFree(ptr, 0, MEM_RELEASE);
+}
+#else
+void* alloc_local(const size_t size)
+{
+	void * const ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) return nullptr;
+
+	// the default policy places a page on the node that first touches it
+	const long page = sysconf(_SC_PAGESIZE);
+	for (size_t ofs = 0; ofs < size; ofs += page) {
+		static_cast<volatile char*>(ptr)[ofs] = 0;
+	}
+	return ptr;
+}
+
+void free_local(void * const ptr, const size_t size)
+{
+	munmap(ptr, size);
 }
+#endif
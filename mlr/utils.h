@@ -16,8 +16,28 @@ long long getmtime(const std::string& fn);
 std::vector<char> file_get_contents(const std::string& fn);
 void file_get_contents(const std::string& fn, std::vector<char>& buf);
 
+/*
+ * how workers are placed on the machine.
+ * CORES binds one worker per physical core, THREADS one per logical
+ * processor (physical cores first, then their SMT siblings), NONE
+ * leaves scheduling to the os and uses every logical processor.
+ */
+enum CpuBindPolicy {
+	CPU_BIND_NONE,
+	CPU_BIND_CORES,
+	CPU_BIND_THREADS
+};
+
+void set_cpu_bind_policy(const CpuBindPolicy policy);
+CpuBindPolicy get_cpu_bind_policy();
+// "cores", "threads" or "none", as given in demo.json or with --bind
+bool cpu_bind_policy_from_name(const std::string& name, CpuBindPolicy& policy);
+
 unsigned get_cpu_count();
 void sse_configure();
 void bind_to_cpu(const unsigned cpu);
 
+void* alloc_local(const size_t size);
+void free_local(void * const ptr, const size_t size);
+
 #endif //__UTILS_H
@@ -1,10 +1,13 @@
 
 #include "stdafx.h"
 
+#include <cfloat>
 #include <iostream>
 #include <boost/format.hpp>
 
-#include "conio.h"
+#ifdef _MSC_VER
+#include <conio.h>
+#endif
 
 #include "vec.h"
 
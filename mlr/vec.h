@@ -2,6 +2,7 @@
 #ifndef __VEC_H
 #define __VEC_H
 
+#include <cmath>
 #include <iostream>
 #include <array>
 #include <algorithm>
@@ -9,6 +10,25 @@
 
 #include <emmintrin.h>
 
+/*
+ * instruction sets past SSE2, where the compiler may use them.  gcc and
+ * clang say so for -msse3 and up, msvc only for /arch:AVX and up, which
+ * imply the rest.  the kernels built for SSE4.1 with msvc define these
+ * themselves (see kernels_sse41.cpp).
+ */
+#if !defined(VEC_SSE3) && (defined(__SSE3__) || defined(__AVX__))
+#define VEC_SSE3
+#endif
+#if !defined(VEC_SSE41) && (defined(__SSE4_1__) || defined(__AVX__))
+#define VEC_SSE41
+#endif
+#ifdef VEC_SSE3
+#include <pmmintrin.h>
+#endif
+#ifdef VEC_SSE41
+#include <smmintrin.h>
+#endif
+
 #include "ryg_srgb.h"
 
 static const double PI = 3.14159265358979323846F;
@@ -41,7 +61,6 @@ template<typename T>
 T saturate(const T& a) {
 	return clamp<T>(a, 0, 1);
 }
-*/
 
 
 template<typename T>
@@ -55,10 +74,23 @@ T smootherstep(const T a, const T b, const T t) {
 	const T x = saturate<T>((t - a) / (b - a));
 	return x*x*x * (x * (x * 6 - 15) + 10);
 }
+*/
+
 
+// constant needed for abs & operator-, from the fastcpp code.  made
+// where it's used: a global would be set up before main() with the
+// instructions of whichever file it's in, AVX2 for some of the kernels
+__forceinline __m128 signmask() { return _mm_castsi128_ps(_mm_set1_epi32(0x80000000)); }
 
-// constant needed for abs & operator-, from the fastcpp code
-static const __m128 SIGNMASK = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+// _mm_hadd_ps(), from SSE2 shuffles where SSE3 can't be assumed
+__forceinline __m128 hadd(const __m128 a, const __m128 b)
+{
+#ifdef VEC_SSE3
+	return _mm_hadd_ps(a, b);
+#else
+	return _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+#endif
+}
 
 #define realtofixed(x) ((x)*65536l)
 
@@ -102,14 +134,14 @@ __forceinline double fastpow(double a, double b) {
 
 struct irect {
 	int y0, y1, x0, x1;
-	irect::irect(const int y0, const int y1, const int x0, const int x1) :y0(y0), y1(y1), x0(x0), x1(x1) {}
-	irect::irect(){}
+	irect(const int y0, const int y1, const int x0, const int x1) :y0(y0), y1(y1), x0(x0), x1(x1) {}
+	irect(){}
 };
 
 
 
 
-__declspec(align(16)) struct vec2 {
+struct __declspec(align(16)) vec2 {
 
 	__forceinline  vec2() :x(0), y(0) {}
 	__forceinline  vec2(float a) : x(a), y(a) {}
@@ -164,7 +196,7 @@ __declspec(align(16)) struct vec2 {
 
 
 
-__declspec(align(16)) struct vec3 {
+struct __declspec(align(16)) vec3 {
 
 	__forceinline vec3(const float a, const float b, const float c) :v(_mm_set_ps(0, c, b, a)){}
 	__forceinline vec3(const float a) : v(_mm_set_ps(0, a, a, a)){}
@@ -194,8 +226,8 @@ __declspec(align(16)) struct vec3 {
 	__forceinline vec3& operator*=(const float b) { v = _mm_mul_ps(v, _mm_set1_ps(b)); return *this; }
 	__forceinline vec3& operator/=(const float b) { v = _mm_div_ps(v, _mm_set1_ps(b)); return *this; }
 
-	__forceinline friend vec3 operator-(const vec3& a) { return vec3(_mm_xor_ps(a.v, SIGNMASK)); }
-	__forceinline friend vec3 abs(const vec3& a) { return vec3(_mm_andnot_ps(SIGNMASK, a.v)); }
+	__forceinline friend vec3 operator-(const vec3& a) { return vec3(_mm_xor_ps(a.v, signmask())); }
+	__forceinline friend vec3 abs(const vec3& a) { return vec3(_mm_andnot_ps(signmask(), a.v)); }
 
 	__forceinline friend vec3 clamp(const vec3& a, float minval, float maxval)
 	{
@@ -236,8 +268,8 @@ __declspec(align(16)) struct vec3 {
 	__forceinline friend float dot(const vec3 &a, const vec3 &b) {
 		float r;
 		const __m128 r1 = _mm_mul_ps(a.v, b.v);
-		const __m128 r2 = _mm_hadd_ps(r1, r1);
-		const __m128 r3 = _mm_hadd_ps(r2, r2);
+		const __m128 r2 = hadd(r1, r1);
+		const __m128 r3 = hadd(r2, r2);
 		_mm_store_ss(&r, r3);
 		return r;
 	}
@@ -268,7 +300,7 @@ __declspec(align(16)) struct vec3 {
 
 
 
-__declspec(align(16)) struct ivec2 {
+struct __declspec(align(16)) ivec2 {
 
 	__forceinline ivec2(const int a, const int b) : x(a), y(b){}
 	__forceinline ivec2(const int a) : x(a), y(a) {}
@@ -288,7 +320,7 @@ __declspec(align(16)) struct ivec2 {
 	int x, y;
 };
 
-__declspec(align(16)) struct ivec3 {
+struct __declspec(align(16)) ivec3 {
 
 	__forceinline ivec3(const int a, const int b, const int c) : v(_mm_set_epi32(0, c, b, a)){}
 	__forceinline ivec3(const int a) : v(_mm_set_epi32(0, a, a, a)){}
@@ -314,7 +346,7 @@ __declspec(align(16)) struct ivec3 {
 
 
 
-__declspec(align(16)) struct vec4 {
+struct __declspec(align(16)) vec4 {
 
 	__forceinline vec4(const float a, const float b, const float c, const float d) : v(_mm_set_ps(d, c, b, a)){}
 	//__forceinline vec4( const float a, const float b, const float c )                : v(_mm_set_ps(0,c,b,a)){}
@@ -361,14 +393,14 @@ __declspec(align(16)) struct vec4 {
 	__forceinline vec4& operator*=(const float b)      { v = _mm_mul_ps(v, _mm_set1_ps(b)); return *this; }
 	__forceinline vec4& operator/=(const float b)      { v = _mm_div_ps(v, _mm_set1_ps(b)); return *this; }
 
-	__forceinline friend vec4 operator-(const vec4& a) { return vec4(_mm_xor_ps(a.v, SIGNMASK)); }
-	__forceinline friend vec4 abs(const vec4& a) { return vec4(_mm_andnot_ps(SIGNMASK, a.v)); }
+	__forceinline friend vec4 operator-(const vec4& a) { return vec4(_mm_xor_ps(a.v, signmask())); }
+	__forceinline friend vec4 abs(const vec4& a) { return vec4(_mm_andnot_ps(signmask(), a.v)); }
 
 	__forceinline friend float dot(const vec4 &a, const vec4 &b) {
 		float r;
 		__m128 r1 = _mm_mul_ps(a.v, b.v);
-		__m128 r2 = _mm_hadd_ps(r1, r1);
-		__m128 r3 = _mm_hadd_ps(r2, r2);
+		__m128 r2 = hadd(r1, r1);
+		__m128 r3 = hadd(r2, r2);
 		_mm_store_ss(&r, r3);
 		return r;
 	}
@@ -376,8 +408,8 @@ __declspec(align(16)) struct vec4 {
 	__forceinline friend float length(const vec4 &a) {
 		float r;
 		__m128 r1 = _mm_mul_ps(a.v, a.v);
-		__m128 r2 = _mm_hadd_ps(r1, r1);
-		__m128 r3 = _mm_hadd_ps(r2, r2);
+		__m128 r2 = hadd(r1, r1);
+		__m128 r3 = hadd(r2, r2);
 		_mm_store_ss(&r, _mm_sqrt_ss(r3));
 		return r;
 	}
@@ -410,8 +442,13 @@ __declspec(align(16)) struct vec4 {
 	__forceinline vec4 xyxy() const { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 0, 1)); }
 	__forceinline vec4 zwzw() const { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 2, 3)); }
 
+#ifdef VEC_SSE3
 	__forceinline vec4 yyww() const { return _mm_movehdup_ps(v); }
 	__forceinline vec4 xxzz() const { return _mm_moveldup_ps(v); }
+#else
+	__forceinline vec4 yyww() const { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 1, 1)); }
+	__forceinline vec4 xxzz() const { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 0, 0)); }
+#endif
 
 	__forceinline float _x() const { float a; _mm_store_ss(&a,        v); return a; }
 	__forceinline float _y() const { float a; _mm_store_ss(&a, yyyy().v); return a; }
@@ -609,7 +646,7 @@ struct Plane {
 typedef float mvec4[4];
 //typedef mvec4 mat4[4];
 
-__declspec(align(16)) struct mat4 {
+struct __declspec(align(16)) mat4 {
 
 	__forceinline mat4(const __m128& a, const __m128& b, const __m128& c, const __m128& d) : m1(a), m2(b), m3(c), m4(d) {}
 
@@ -815,6 +852,24 @@ __forceinline vec4 mat4_mul(const mat4& a, const vec4& b)
 }
 
 
+/*
+ * no longer than this is any unit vector after m, for scaling bounding
+ * spheres.  the square of the largest stretch is the largest eigenvalue
+ * of the columns' dot products, which is bounded by gershgorin's circles
+ * and by the sum of the columns' squared lengths, whichever is smaller.
+ * it is exact for rotations and scales.  the longest column on its own
+ * is not safe under shear.
+ */
+__forceinline float mat4_max_stretch(const mat4& m)
+{
+	const vec4 ax(m.v[0]), ay(m.v[1]), az(m.v[2]);
+	const float xx = dot(ax, ax), yy = dot(ay, ay), zz = dot(az, az);
+	const float xy = fabs(dot(ax, ay)), xz = fabs(dot(ax, az)), yz = fabs(dot(ay, az));
+	const float circles = std::max(std::max(xx + xy + xz, yy + xy + yz), zz + xz + yz);
+	return sqrt(std::min(circles, xx + yy + zz));
+}
+
+
 /*
 __forceinline mat4 mat4_mul(const mat4& a, const mat4& b)
 {
@@ -869,6 +924,9 @@ __forceinline mat4 mat4_mul(const mat4& a, const mat4& b)
 */
 static inline __m128i sse2_mul32(const __m128i& a, const __m128i& b)
 {
+#ifdef VEC_SSE41
+	return _mm_mullo_epi32(a, b);
+#else
 	// mul 2,0
 	const __m128i tmp1 = _mm_mul_epu32(a, b);
 
@@ -882,13 +940,14 @@ static inline __m128i sse2_mul32(const __m128i& a, const __m128i& b)
 		_mm_shuffle_epi32(tmp1, _MM_SHUFFLE(0, 0, 2, 0))
 		, _mm_shuffle_epi32(tmp2, _MM_SHUFFLE(0, 0, 2, 0))
 		);
+#endif
 }
 
 
 
 
 
-__declspec(align(16)) struct ivec4 {
+struct __declspec(align(16)) ivec4 {
 
 	__forceinline ivec4() {}
 	//__forceinline ivec4():v(_mm_setzero_si128()){}
@@ -913,6 +972,7 @@ public:
 		__m128i v;
 		__m128 f;
 		struct { int x, y, z, w; };
+		int si[4];
 	};
 };
 
@@ -924,8 +984,13 @@ __forceinline ivec4 operator &(const ivec4& a, const ivec4& b) { return ivec4(_m
 
 __forceinline ivec4 andnot(const ivec4& a, const ivec4& b) { return ivec4(_mm_andnot_si128(a.v, b.v)); }
 
-//__forceinline ivec4 vmin( const ivec4& a, const ivec4& b ) { return ivec4(_mm_min_epi32(a.v,b.v)); }
-//__forceinline ivec4 vmax( const ivec4& a, const ivec4& b ) { return ivec4(_mm_max_epi32(a.v,b.v)); }
+#ifdef VEC_SSE41
+__forceinline ivec4 vmin( const ivec4& a, const ivec4& b ) { return ivec4(_mm_min_epi32(a.v,b.v)); }
+__forceinline ivec4 vmax( const ivec4& a, const ivec4& b ) { return ivec4(_mm_max_epi32(a.v,b.v)); }
+#else
+__forceinline ivec4 vmin( const ivec4& a, const ivec4& b ) { const ivec4 m(_mm_cmpgt_epi32(a.v,b.v)); return andnot(m, a) | (b & m); }
+__forceinline ivec4 vmax( const ivec4& a, const ivec4& b ) { const ivec4 m(_mm_cmpgt_epi32(a.v,b.v)); return andnot(m, b) | (a & m); }
+#endif
 __forceinline  vec4 vmin(const  vec4& a, const  vec4& b) { return  vec4(_mm_min_ps(a.v, b.v)); }
 __forceinline  vec4 vmax(const  vec4& a, const  vec4& b) { return  vec4(_mm_max_ps(a.v, b.v)); }
 
@@ -942,6 +1007,7 @@ __forceinline ivec4 cmpgt(const ivec4&a, const ivec4& b) { return ivec4(_mm_cmpg
 __forceinline  vec4 cmplt(const  vec4&a, const  vec4& b) { return  vec4(_mm_cmplt_ps(a.v, b.v)); }
 __forceinline  vec4 cmple(const  vec4&a, const  vec4& b) { return  vec4(_mm_cmple_ps(a.v, b.v)); }
 __forceinline  vec4 cmpge(const  vec4&a, const  vec4& b) { return  vec4(_mm_cmpge_ps(a.v, b.v)); }
+__forceinline  vec4 cmpeq(const  vec4&a, const  vec4& b) { return  vec4(_mm_cmpeq_ps(a.v, b.v)); }
 __forceinline  vec4 cmpgt(const  vec4&a, const  vec4& b) { return  vec4(_mm_cmpgt_ps(a.v, b.v)); }
 
 __forceinline ivec4 float2bits(const  vec4 &a) { return ivec4(_mm_castps_si128(a.v)); }
@@ -0,0 +1,159 @@
+#ifndef __VEC8_H
+#define __VEC8_H
+
+#include "stdafx.h"
+
+#include <immintrin.h>
+
+#include "vec.h"
+#include "vec_soa.h"
+
+/*
+ * 8-wide vec4 and ivec4, for rasterizing two quads at once.  the two
+ * quads are horizontally adjacent, the left one in the low half, each
+ * in its usual lane order, so a half is just what the 4-wide code would
+ * have had.  only there when the target has AVX2.
+ */
+#ifdef __AVX2__
+
+struct __declspec(align(32)) vec8 {
+
+	__forceinline vec8(const float a, const float b, const float c, const float d, const float e, const float f, const float g, const float h) : v(_mm256_set_ps(h, g, f, e, d, c, b, a)){}
+	__forceinline vec8(const float a) : v(_mm256_set1_ps(a)){}
+	__forceinline vec8(){}
+	__forceinline vec8(__m256 m) : v(m){}
+	__forceinline vec8(const vec4& lo, const vec4& hi) : v(_mm256_insertf128_ps(_mm256_castps128_ps256(lo.v), hi.v, 1)){}
+
+	// the same quad in both halves
+	static __forceinline vec8 twice(const vec4& a) {
+		return vec8(_mm256_broadcast_ps(&a.v));
+	}
+
+	// two quads from the 2x2 buffers, which keep them next to each other
+	static __forceinline vec8 load(const __m128 *a) {
+		return vec8(_mm256_loadu_ps(reinterpret_cast<const float*>(a)));
+	}
+
+	__forceinline void store(__m128 *out) const {
+		_mm256_storeu_ps(reinterpret_cast<float*>(out), v);
+	}
+
+	__forceinline vec4 lo() const { return vec4(_mm256_castps256_ps128(v)); }
+	__forceinline vec4 hi() const { return vec4(_mm256_extractf128_ps(v, 1)); }
+
+	__forceinline vec8  operator+ (const vec8& b) const { return _mm256_add_ps(v, b.v); }
+	__forceinline vec8  operator- (const vec8& b) const { return _mm256_sub_ps(v, b.v); }
+	__forceinline vec8  operator* (const vec8& b) const { return _mm256_mul_ps(v, b.v); }
+	__forceinline vec8  operator/ (const vec8& b) const { return _mm256_div_ps(v, b.v); }
+
+	__forceinline vec8& operator+=(const vec8& b)       { v = _mm256_add_ps(v, b.v); return *this; }
+	__forceinline vec8& operator*=(const vec8& b)       { v = _mm256_mul_ps(v, b.v); return *this; }
+
+	__m256 v;
+};
+
+
+struct __declspec(align(32)) ivec8 {
+
+	__forceinline ivec8() {}
+	__forceinline ivec8(const int a) : v(_mm256_set1_epi32(a)){}
+	__forceinline ivec8(__m256i m) : v(m){}
+	__forceinline ivec8(const ivec4& lo, const ivec4& hi) : v(_mm256_inserti128_si256(_mm256_castsi128_si256(lo.v), hi.v, 1)){}
+
+	__forceinline ivec4 lo() const { return ivec4(_mm256_castsi256_si128(v)); }
+	__forceinline ivec4 hi() const { return ivec4(_mm256_extracti128_si256(v, 1)); }
+
+	__forceinline ivec8& operator +=(const ivec8& b) { v = _mm256_add_epi32(v, b.v); return *this; }
+
+	__m256i v;
+};
+
+__forceinline ivec8 operator +(const ivec8& a, const ivec8& b) { return ivec8(_mm256_add_epi32(a.v, b.v)); }
+__forceinline ivec8 operator -(const ivec8& a, const ivec8& b) { return ivec8(_mm256_sub_epi32(a.v, b.v)); }
+__forceinline ivec8 operator |(const ivec8& a, const ivec8& b) { return ivec8(_mm256_or_si256(a.v, b.v)); }
+__forceinline ivec8 operator &(const ivec8& a, const ivec8& b) { return ivec8(_mm256_and_si256(a.v, b.v)); }
+
+__forceinline ivec8 andnot(const ivec8& a, const ivec8& b) { return ivec8(_mm256_andnot_si256(a.v, b.v)); }
+
+__forceinline vec8 vmin(const vec8& a, const vec8& b) { return vec8(_mm256_min_ps(a.v, b.v)); }
+__forceinline vec8 vmax(const vec8& a, const vec8& b) { return vec8(_mm256_max_ps(a.v, b.v)); }
+
+__forceinline vec8 itof(const ivec8& a) { return vec8(_mm256_cvtepi32_ps(a.v)); }
+
+__forceinline vec8 cmpge(const vec8& a, const vec8& b) { return vec8(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OS)); }
+__forceinline vec8 cmpeq(const vec8& a, const vec8& b) { return vec8(_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)); }
+
+__forceinline ivec8 float2bits(const vec8& a) { return ivec8(_mm256_castps_si256(a.v)); }
+__forceinline vec8 bits2float(const ivec8& a) { return vec8(_mm256_castsi256_ps(a.v)); }
+
+__forceinline int movemask(const vec8& a) { return _mm256_movemask_ps(a.v); }
+
+template<int N> __forceinline ivec8 sar(const ivec8& x) { return ivec8(_mm256_srai_epi32(x.v, N)); }
+
+__forceinline vec8 selectbits(const vec8& a, const vec8& b, const ivec8& mask)
+{
+	const ivec8 a2 = andnot(mask, float2bits(a));
+	const ivec8 b2 = float2bits(b) & mask;
+	return bits2float(a2 | b2);
+}
+
+
+/*
+ * SoA helpers for fragments two quads wide, as in vec_soa.h
+ */
+typedef vec8 ofloat;
+struct ofloat2 {
+	vec8 v[2];
+	__forceinline qfloat2 lo() const { return{ { v[0].lo(), v[1].lo() } }; }
+	__forceinline qfloat2 hi() const { return{ { v[0].hi(), v[1].hi() } }; }
+};
+struct ofloat3 {
+	vec8 v[3];
+	__forceinline void fill(const qfloat3& a) {
+		v[0] = vec8::twice(a.v[0]);
+		v[1] = vec8::twice(a.v[1]);
+		v[2] = vec8::twice(a.v[2]);
+	}
+	__forceinline ofloat3 operator*(const ofloat& b) const { return{ { v[0]*b, v[1]*b, v[2]*b } }; }
+};
+struct ofloat4 {
+	vec8 v[4];
+	__forceinline void set(const ofloat3& a) {
+		v[0] = a.v[0];
+		v[1] = a.v[1];
+		v[2] = a.v[2];
+	}
+	__forceinline void set(const qfloat4& lo, const qfloat4& hi) {
+		for (int i = 0; i < 4; i++) v[i] = vec8(lo.v[i], hi.v[i]);
+	}
+	__forceinline qfloat4 lo() const { return{ { v[0].lo(), v[1].lo(), v[2].lo(), v[3].lo() } }; }
+	__forceinline qfloat4 hi() const { return{ { v[0].hi(), v[1].hi(), v[2].hi(), v[3].hi() } }; }
+};
+
+struct vertex_float8 {
+	vec8 x[3];
+	__forceinline vertex_float lo() const { vertex_float r; r.set(x[0].lo(), x[1].lo(), x[2].lo()); return r; }
+	__forceinline vertex_float hi() const { vertex_float r; r.set(x[0].hi(), x[1].hi(), x[2].hi()); return r; }
+};
+
+// vertex values are the same in every lane of a quad, and so of both
+__forceinline ofloat vertex_blend(const vertex_float8& bary, const vertex_float& val) {
+	return bary.x[0] * vec8::twice(val.x[0]) + bary.x[1] * vec8::twice(val.x[1]) + bary.x[2] * vec8::twice(val.x[2]);
+}
+__forceinline ofloat2 vertex_blend(const vertex_float8& bary, const vertex_float2& val) {
+	ofloat2 r;
+	r.v[0] = bary.x[0] * vec8::twice(val.x[0]) + bary.x[1] * vec8::twice(val.x[1]) + bary.x[2] * vec8::twice(val.x[2]);
+	r.v[1] = bary.x[0] * vec8::twice(val.y[0]) + bary.x[1] * vec8::twice(val.y[1]) + bary.x[2] * vec8::twice(val.y[2]);
+	return r;
+}
+__forceinline ofloat3 vertex_blend(const vertex_float8& bary, const vertex_float3& val) {
+	ofloat3 r;
+	r.v[0] = bary.x[0] * vec8::twice(val.x[0]) + bary.x[1] * vec8::twice(val.x[1]) + bary.x[2] * vec8::twice(val.x[2]);
+	r.v[1] = bary.x[0] * vec8::twice(val.y[0]) + bary.x[1] * vec8::twice(val.y[1]) + bary.x[2] * vec8::twice(val.y[2]);
+	r.v[2] = bary.x[0] * vec8::twice(val.z[0]) + bary.x[1] * vec8::twice(val.z[1]) + bary.x[2] * vec8::twice(val.z[2]);
+	return r;
+}
+
+#endif //__AVX2__
+
+#endif //__VEC8_H
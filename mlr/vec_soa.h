@@ -152,7 +152,7 @@ __forceinline vec4 mix(const vec4& a, const vec4& b, const vec4& t) {
 
 __forceinline vec4 ddx(const vec4& a)
 {
-	return vec4(_mm_sub_ps(_mm_movehdup_ps(a.v), _mm_moveldup_ps(a.v)));
+	return vec4(_mm_sub_ps(a.yyww().v, a.xxzz().v));
 }
 
 __forceinline vec4 ddy(const vec4& a)
@@ -176,7 +176,7 @@ template<int e>
 __forceinline void fwidth(const vec4 * const __restrict src, vec4 * const __restrict out)
 {
 	for (int i=0; i<e; i++)
-		dst[i] = abs(ddx(s[i])) + abs(ddy(s[i]));
+		out[i] = abs(ddx(src[i])) + abs(ddy(src[i]));
 }
 
 #endif //__VEC_SOA_H
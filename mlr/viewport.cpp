@@ -4,7 +4,9 @@
 #include <iostream>
 #include <boost/format.hpp>
 
+#ifdef _MSC_VER
 #include <conio.h>
+#endif
 
 #include "viewport.h"
 
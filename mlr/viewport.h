@@ -5,6 +5,8 @@
 #include "stdafx.h"
 
 #include "vec.h"
+#include "vec_soa.h"
+#include "xform.h"
 
 struct Viewport
 {
@@ -69,6 +71,17 @@ public:
 		return r4;
 	}
 
+	// the same for four points in SoA, with the same arithmetic
+	__forceinline void clip_to_device(const qfloat4& point_in_clipspace, qfloat4& out) const {
+		qfloat4 src;
+		xform_mul(md, point_in_clipspace, src);
+		const vec4 invw = vec4(1.0f) / src.v[3];
+		out.v[0] = src.v[0] * invw;
+		out.v[1] = src.v[1] * invw;
+		out.v[2] = src.v[2] * invw;
+		out.v[3] = invw;
+	}
+
 public:
 	const int width;
 	const int height;
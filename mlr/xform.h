@@ -0,0 +1,118 @@
+#ifndef __XFORM_H
+#define __XFORM_H
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "vec.h"
+#include "vec_soa.h"
+#include "clip.h"
+
+/*
+ * streaming vertex kernels.  points are read four at a time, turned
+ * into SoA, transformed and written back, so that an instance costs one
+ * pass over its mesh's arrays.  the arithmetic is that of mat4_mul()
+ * and Guardband::clipPoint(), in the same order, so the results are
+ * exactly those of transforming one vertex at a time.
+ */
+
+__forceinline void xform_load(const vec4 * const __restrict src, qfloat4& out)
+{
+	__m128 a = src[0].v, b = src[1].v, c = src[2].v, d = src[3].v;
+	_MM_TRANSPOSE4_PS(a, b, c, d);
+	out.v[0] = a;  out.v[1] = b;  out.v[2] = c;  out.v[3] = d;
+}
+
+__forceinline void xform_store(const qfloat4& in, vec4 * const __restrict dst)
+{
+	__m128 a = in.v[0].v, b = in.v[1].v, c = in.v[2].v, d = in.v[3].v;
+	_MM_TRANSPOSE4_PS(a, b, c, d);
+	dst[0] = a;  dst[1] = b;  dst[2] = c;  dst[3] = d;
+}
+
+__forceinline void xform_mul(const mat4& m, const qfloat4& in, qfloat4& out)
+{
+	for (int j = 0; j < 4; j++) {
+		out.v[j] = vec4(m.f[0][j]) * in.v[0] +
+		           vec4(m.f[1][j]) * in.v[1] +
+		           vec4(m.f[2][j]) * in.v[2] +
+		           vec4(m.f[3][j]) * in.v[3];
+	}
+}
+
+/*
+ * Guardband::clipPoint() for four clip space points, one byte each
+ */
+__forceinline void xform_clipcodes(const qfloat4& c, unsigned char * const __restrict cf)
+{
+	const vec4 gw = vec4(GUARDBAND_FACTOR) * c.v[3];
+	const vec4 zero = vec4::zero();
+	const ivec4 codes =
+		(float2bits(cmple(gw + c.v[0], zero)) & ivec4(CLIP_LEFT)) |
+		(float2bits(cmple(gw + c.v[1], zero)) & ivec4(CLIP_BOTTOM)) |
+		(float2bits(cmple(c.v[3] + c.v[2], zero)) & ivec4(CLIP_NEAR)) |
+		(float2bits(cmple(gw - c.v[0], zero)) & ivec4(CLIP_RIGHT)) |
+		(float2bits(cmple(gw - c.v[1], zero)) & ivec4(CLIP_TOP));
+	const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(codes.v, codes.v), codes.v);
+	const int packed = _mm_cvtsi128_si32(bytes);
+	memcpy(cf, &packed, 4);
+}
+
+
+/*
+ * eye[i] = m * src[i] and cf[i] its clip codes through the projection
+ * proj, for count points.  blocks of four with none of their bits set
+ * in used are skipped and left as they are.
+ */
+inline void xform_points(const mat4& m, const mat4& proj, const vec4 * const __restrict src, const int count, vec4 * const __restrict eye, unsigned char * const __restrict cf, const uint64_t used = ~uint64_t(0))
+{
+	qfloat4 in, eye4, clip4;
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		if (i < 64 && ((used >> i) & 0xf) == 0) continue;
+		xform_load(src + i, in);
+		xform_mul(m, in, eye4);
+		xform_mul(proj, eye4, clip4);
+		xform_store(eye4, eye + i);
+		xform_clipcodes(clip4, cf + i);
+	}
+	if (i < count && (i >= 64 || (used >> i) != 0)) {
+		// the last few go through a padded block
+		vec4 src_tail[4], eye_tail[4];
+		unsigned char cf_tail[4];
+		const int rest = count - i;
+		for (int k = 0; k < 4; k++) src_tail[k] = src[i + std::min(k, rest - 1)];
+		xform_load(src_tail, in);
+		xform_mul(m, in, eye4);
+		xform_mul(proj, eye4, clip4);
+		xform_store(eye4, eye_tail);
+		xform_clipcodes(clip4, cf_tail);
+		for (int k = 0; k < rest; k++) {
+			eye[i + k] = eye_tail[k];
+			cf[i + k] = cf_tail[k];
+		}
+	}
+}
+
+
+/*
+ * dst[i] = m * src[i], for normals and other vectors with w = 0
+ */
+inline void xform_vectors(const mat4& m, const vec4 * const __restrict src, const int count, vec4 * const __restrict dst)
+{
+	qfloat4 in, out;
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		xform_load(src + i, in);
+		xform_mul(m, in, out);
+		xform_store(out, dst + i);
+	}
+	for (; i < count; i++) {
+		dst[i] = mat4_mul(m, src[i]);
+	}
+}
+
+#endif //__XFORM_H